@@ -0,0 +1,772 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "Bounds.h"
+#include "Frustum.h"
+#include "Simd.h"
+
+#include <glm/glm/glm.hpp>
+#include <algorithm>
+#include <cfloat>
+#include <vector>
+
+using namespace std;
+using namespace glm;
+
+// Four children per node, their bounds stored per axis so one SSE compare tests all four
+struct BVHNode
+{
+	float minX[4], minY[4], minZ[4];
+	float maxX[4], maxY[4], maxZ[4];
+	int child[4]; // Node index, or the leaf's first entry in the primitive order
+	int count[4]; // 0 for a child node, primitive count for a leaf, -1 for an empty slot
+};
+
+// Bounding volume hierarchy over primitive boxes (usually objects in world space)
+// Built as a binary tree with binned SAH, then collapsed into 4-wide nodes for traversal
+// Moving primitives only refits the boxes above them, Build again when the tree gets loose
+class BVH
+{
+public:
+	static const int MAX_LEAF_SIZE = 4;
+	static const int BIN_COUNT = 16;
+
+	BVH()
+	{
+		lastDirty = -1;
+	}
+
+	// Primitive i is bounds[i], queries return these indices
+	void Build(const vector<AABB>& bounds)
+	{
+		primitiveBounds = bounds;
+		int count = (int)bounds.size();
+
+		primitiveOrder.resize(count);
+		vector<vec3> centroids(count);
+		for (int i = 0; i < count; i++)
+		{
+			primitiveOrder[i] = i;
+			centroids[i] = bounds[i].GetCenter();
+		}
+
+		vector<BuildNode> buildNodes;
+		buildNodes.reserve(count > 0 ? 2 * count / MAX_LEAF_SIZE + 1 : 0);
+		BuildBinary(buildNodes, centroids);
+		Collapse(buildNodes);
+
+		dirty.assign(nodes.size(), 0);
+		lastDirty = -1;
+	}
+
+	// Call Refit before the next query
+	void SetBounds(int primitive, const AABB& bounds)
+	{
+		primitiveBounds[primitive] = bounds;
+		int node = primitiveLeaves[primitive];
+		dirty[node] = 1;
+		lastDirty = std::max(lastDirty, node);
+	}
+
+	const AABB& GetBounds(int primitive) const
+	{
+		return primitiveBounds[primitive];
+	}
+
+	// Recomputes the boxes of nodes above moved primitives, children come after their parents so one backwards pass is enough
+	void Refit()
+	{
+		for (int i = lastDirty; i >= 0; i--)
+		{
+			if (!dirty[i])
+			{
+				continue;
+			}
+			dirty[i] = 0;
+
+			BVHNode& node = nodes[i];
+			for (int slot = 0; slot < 4; slot++)
+			{
+				if (node.count[slot] < 0)
+				{
+					continue;
+				}
+
+				AABB bounds = node.count[slot] > 0 ? LeafBounds(node.child[slot], node.count[slot]) : NodeBounds(nodes[node.child[slot]]);
+				SetSlot(node, slot, bounds);
+			}
+
+			if (parents[i] != -1)
+			{
+				dirty[parents[i]] = 1;
+			}
+		}
+		lastDirty = -1;
+	}
+
+	// Primitives whose box touches the frustum, subtrees fully inside are added without further tests
+	void QueryFrustum(const Frustum& frustum, vector<int>& results) const
+	{
+		results.clear();
+		if (nodes.empty())
+		{
+			return;
+		}
+
+		vector<int>& stack = GetStack();
+		stack.push_back(0);
+		while (!stack.empty())
+		{
+			int nodeIndex = stack.back();
+			stack.pop_back();
+			const BVHNode& node = nodes[nodeIndex];
+
+			int insideMask;
+			int hitMask = TestFrustum(node, frustum, insideMask);
+			for (int slot = 0; slot < 4; slot++)
+			{
+				if (!(hitMask & (1 << slot)) || node.count[slot] < 0)
+				{
+					continue;
+				}
+
+				if (insideMask & (1 << slot))
+				{
+					AddSubtree(node, slot, results);
+				}
+				else if (node.count[slot] > 0)
+				{
+					for (int i = node.child[slot]; i < node.child[slot] + node.count[slot]; i++)
+					{
+						if (IsInFrustum(primitiveBounds[primitiveOrder[i]], frustum))
+						{
+							results.push_back(primitiveOrder[i]);
+						}
+					}
+				}
+				else
+				{
+					stack.push_back(node.child[slot]);
+				}
+			}
+		}
+	}
+
+	// Primitives whose box overlaps the query box
+	void QueryBox(const AABB& box, vector<int>& results) const
+	{
+		results.clear();
+		if (nodes.empty())
+		{
+			return;
+		}
+
+		vector<int>& stack = GetStack();
+		stack.push_back(0);
+		while (!stack.empty())
+		{
+			const BVHNode& node = nodes[stack.back()];
+			stack.pop_back();
+
+			int hitMask = TestBox(node, box);
+			for (int slot = 0; slot < 4; slot++)
+			{
+				if (!(hitMask & (1 << slot)) || node.count[slot] < 0)
+				{
+					continue;
+				}
+
+				if (node.count[slot] == 0)
+				{
+					stack.push_back(node.child[slot]);
+					continue;
+				}
+				for (int i = node.child[slot]; i < node.child[slot] + node.count[slot]; i++)
+				{
+					const AABB& bounds = primitiveBounds[primitiveOrder[i]];
+					if (Overlaps(bounds, box))
+					{
+						results.push_back(primitiveOrder[i]);
+					}
+				}
+			}
+		}
+	}
+
+	// Nearest primitive box hit by the ray within distance, -1 if none
+	// distance is updated to where the ray enters that box
+	int Raycast(const vec3& origin, const vec3& direction, float& distance) const
+	{
+		if (nodes.empty())
+		{
+			return -1;
+		}
+
+		Ray ray;
+		ray.origin = origin;
+		ray.inverseDirection = vec3(1.0f) / direction;
+
+		int closest = -1;
+		vector<int>& stack = GetStack();
+		vector<float>& stackDistances = GetStackDistances();
+		stack.push_back(0);
+		stackDistances.push_back(0.0f);
+		while (!stack.empty())
+		{
+			int nodeIndex = stack.back();
+			float enterDistance = stackDistances.back();
+			stack.pop_back();
+			stackDistances.pop_back();
+			if (enterDistance > distance)
+			{
+				continue; // A closer hit was found after this node was pushed
+			}
+
+			const BVHNode& node = nodes[nodeIndex];
+			float enter[4];
+			int hitMask = TestRay(node, ray, distance, enter);
+
+			// Far children are pushed first so the nearest one is visited next
+			int order[4];
+			int hitCount = 0;
+			for (int slot = 0; slot < 4; slot++)
+			{
+				if ((hitMask & (1 << slot)) && node.count[slot] >= 0)
+				{
+					order[hitCount++] = slot;
+				}
+			}
+			for (int i = 1; i < hitCount; i++)
+			{
+				for (int j = i; j > 0 && enter[order[j]] > enter[order[j - 1]]; j--)
+				{
+					swap(order[j], order[j - 1]);
+				}
+			}
+
+			for (int i = 0; i < hitCount; i++)
+			{
+				int slot = order[i];
+				if (node.count[slot] == 0)
+				{
+					stack.push_back(node.child[slot]);
+					stackDistances.push_back(enter[slot]);
+					continue;
+				}
+				for (int j = node.child[slot]; j < node.child[slot] + node.count[slot]; j++)
+				{
+					float primitiveDistance;
+					if (IntersectRay(primitiveBounds[primitiveOrder[j]], ray, distance, primitiveDistance))
+					{
+						distance = primitiveDistance;
+						closest = primitiveOrder[j];
+					}
+				}
+			}
+		}
+		return closest;
+	}
+
+	int GetNodeCount() const
+	{
+		return (int)nodes.size();
+	}
+
+	int GetPrimitiveCount() const
+	{
+		return (int)primitiveBounds.size();
+	}
+
+private:
+	struct BuildNode
+	{
+		AABB bounds;
+		int left;
+		int right;
+		int first; // Range of the primitive order, leaves only
+		int count; // 0 for inner nodes
+	};
+
+	struct Bin
+	{
+		AABB bounds;
+		int count;
+	};
+
+	struct Ray
+	{
+		vec3 origin;
+		vec3 inverseDirection;
+	};
+
+	vector<BVHNode> nodes;
+	vector<int> parents;		 // -1 for the root
+	vector<AABB> primitiveBounds;
+	vector<int> primitiveOrder;	 // Leaves cover contiguous ranges of it
+	vector<int> primitiveLeaves; // Node whose leaf slot holds each primitive
+	vector<unsigned char> dirty;
+	int lastDirty; // Highest node index that may be dirty
+
+	// Traversal stacks, one per thread so queries can run in parallel
+	static vector<int>& GetStack()
+	{
+		static thread_local vector<int> stack;
+		stack.clear();
+		return stack;
+	}
+
+	static vector<float>& GetStackDistances()
+	{
+		static thread_local vector<float> stackDistances;
+		stackDistances.clear();
+		return stackDistances;
+	}
+
+	static AABB EmptyBounds()
+	{
+		AABB bounds;
+		bounds.min = vec3(FLT_MAX);
+		bounds.max = vec3(-FLT_MAX);
+		return bounds;
+	}
+
+	static void Grow(AABB& bounds, const AABB& other)
+	{
+		bounds.min = glm::min(bounds.min, other.min);
+		bounds.max = glm::max(bounds.max, other.max);
+	}
+
+	static float SurfaceArea(const AABB& bounds)
+	{
+		vec3 size = bounds.max - bounds.min;
+		return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+	}
+
+	// Top down, every node is split at the cheapest of BIN_COUNT - 1 planes along its widest centroid axis
+	void BuildBinary(vector<BuildNode>& buildNodes, const vector<vec3>& centroids)
+	{
+		int primitiveCount = (int)primitiveOrder.size();
+		if (primitiveCount == 0)
+		{
+			return;
+		}
+
+		buildNodes.push_back(BuildNode());
+		buildNodes[0].first = 0;
+		buildNodes[0].count = primitiveCount;
+
+		// Nodes to split, iterative so unbalanced trees cannot overflow the call stack
+		vector<int> pending(1, 0);
+		while (!pending.empty())
+		{
+			int nodeIndex = pending.back();
+			pending.pop_back();
+			int first = buildNodes[nodeIndex].first;
+			int count = buildNodes[nodeIndex].count;
+
+			AABB bounds = EmptyBounds();
+			AABB centroidBounds = EmptyBounds();
+			for (int i = first; i < first + count; i++)
+			{
+				int primitive = primitiveOrder[i];
+				Grow(bounds, primitiveBounds[primitive]);
+				centroidBounds.min = glm::min(centroidBounds.min, centroids[primitive]);
+				centroidBounds.max = glm::max(centroidBounds.max, centroids[primitive]);
+			}
+			buildNodes[nodeIndex].bounds = bounds;
+			if (count <= MAX_LEAF_SIZE)
+			{
+				continue;
+			}
+
+			vec3 extent = centroidBounds.max - centroidBounds.min;
+			int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+			int middle;
+
+			if (extent[axis] <= 0.0f)
+			{
+				// Every centroid in the same place, any split is as good
+				middle = first + count / 2;
+			}
+			else
+			{
+				Bin bins[BIN_COUNT];
+				for (int b = 0; b < BIN_COUNT; b++)
+				{
+					bins[b].bounds = EmptyBounds();
+					bins[b].count = 0;
+				}
+
+				float binScale = BIN_COUNT / extent[axis];
+				float binStart = centroidBounds.min[axis];
+				for (int i = first; i < first + count; i++)
+				{
+					int primitive = primitiveOrder[i];
+					int b = std::min(BIN_COUNT - 1, (int)((centroids[primitive][axis] - binStart) * binScale));
+					Grow(bins[b].bounds, primitiveBounds[primitive]);
+					bins[b].count++;
+				}
+
+				// Sweeps from the right first, then scores every plane from the left
+				float rightArea[BIN_COUNT];
+				int rightCount[BIN_COUNT];
+				AABB right = EmptyBounds();
+				int rightTotal = 0;
+				for (int b = BIN_COUNT - 1; b > 0; b--)
+				{
+					Grow(right, bins[b].bounds);
+					rightTotal += bins[b].count;
+					rightArea[b] = rightTotal > 0 ? SurfaceArea(right) : 0.0f;
+					rightCount[b] = rightTotal;
+				}
+
+				AABB left = EmptyBounds();
+				int leftTotal = 0;
+				float bestCost = FLT_MAX;
+				int bestPlane = 1;
+				for (int b = 1; b < BIN_COUNT; b++)
+				{
+					Grow(left, bins[b - 1].bounds);
+					leftTotal += bins[b - 1].count;
+					if (leftTotal == 0 || rightCount[b] == 0)
+					{
+						continue;
+					}
+
+					float cost = leftTotal * SurfaceArea(left) + rightCount[b] * rightArea[b];
+					if (cost < bestCost)
+					{
+						bestCost = cost;
+						bestPlane = b;
+					}
+				}
+
+				int* splitPoint = partition(&primitiveOrder[first], &primitiveOrder[first] + count, [&](int primitive)
+				{
+					return std::min(BIN_COUNT - 1, (int)((centroids[primitive][axis] - binStart) * binScale)) < bestPlane;
+				});
+				middle = (int)(splitPoint - &primitiveOrder[0]);
+				if (middle == first || middle == first + count)
+				{
+					middle = first + count / 2;
+				}
+			}
+
+			int leftIndex = (int)buildNodes.size();
+			buildNodes.push_back(BuildNode());
+			buildNodes.push_back(BuildNode());
+			buildNodes[leftIndex].first = first;
+			buildNodes[leftIndex].count = middle - first;
+			buildNodes[leftIndex + 1].first = middle;
+			buildNodes[leftIndex + 1].count = first + count - middle;
+
+			buildNodes[nodeIndex].left = leftIndex;
+			buildNodes[nodeIndex].right = leftIndex + 1;
+			buildNodes[nodeIndex].count = 0;
+			pending.push_back(leftIndex + 1);
+			pending.push_back(leftIndex);
+		}
+	}
+
+	// Every wide node takes the children of up to three binary levels, opening the largest inner child first
+	void Collapse(const vector<BuildNode>& buildNodes)
+	{
+		nodes.clear();
+		parents.clear();
+		primitiveLeaves.assign(primitiveOrder.size(), 0);
+		if (buildNodes.empty())
+		{
+			return;
+		}
+
+		nodes.push_back(BVHNode());
+		parents.push_back(-1);
+
+		// (binary node, wide node) pairs, the wide node is filled from the binary node's descendants
+		vector<pair<int, int>> pending(1, make_pair(0, 0));
+		while (!pending.empty())
+		{
+			int binaryIndex = pending.back().first;
+			int wideIndex = pending.back().second;
+			pending.pop_back();
+
+			int children[4];
+			int childCount = 0;
+			if (buildNodes[binaryIndex].count > 0)
+			{
+				children[childCount++] = binaryIndex; // Single leaf root
+			}
+			else
+			{
+				children[childCount++] = buildNodes[binaryIndex].left;
+				children[childCount++] = buildNodes[binaryIndex].right;
+			}
+
+			while (childCount < 4)
+			{
+				int largest = -1;
+				float largestArea = -1.0f;
+				for (int i = 0; i < childCount; i++)
+				{
+					const BuildNode& child = buildNodes[children[i]];
+					if (child.count == 0 && SurfaceArea(child.bounds) > largestArea)
+					{
+						largest = i;
+						largestArea = SurfaceArea(child.bounds);
+					}
+				}
+				if (largest == -1)
+				{
+					break;
+				}
+
+				int opened = children[largest];
+				children[largest] = buildNodes[opened].left;
+				children[childCount++] = buildNodes[opened].right;
+			}
+
+			for (int slot = 0; slot < 4; slot++)
+			{
+				BVHNode& node = nodes[wideIndex];
+				if (slot >= childCount)
+				{
+					SetSlot(node, slot, EmptyBounds());
+					node.child[slot] = 0;
+					node.count[slot] = -1;
+					continue;
+				}
+
+				const BuildNode& child = buildNodes[children[slot]];
+				SetSlot(node, slot, child.bounds);
+				if (child.count > 0)
+				{
+					node.child[slot] = child.first;
+					node.count[slot] = child.count;
+					for (int i = child.first; i < child.first + child.count; i++)
+					{
+						primitiveLeaves[primitiveOrder[i]] = wideIndex;
+					}
+				}
+				else
+				{
+					int childIndex = (int)nodes.size();
+					node.child[slot] = childIndex;
+					node.count[slot] = 0;
+					nodes.push_back(BVHNode()); // node is not used past this point
+					parents.push_back(wideIndex);
+					pending.push_back(make_pair(children[slot], childIndex));
+				}
+			}
+		}
+	}
+
+	static void SetSlot(BVHNode& node, int slot, const AABB& bounds)
+	{
+		node.minX[slot] = bounds.min.x;
+		node.minY[slot] = bounds.min.y;
+		node.minZ[slot] = bounds.min.z;
+		node.maxX[slot] = bounds.max.x;
+		node.maxY[slot] = bounds.max.y;
+		node.maxZ[slot] = bounds.max.z;
+	}
+
+	static AABB NodeBounds(const BVHNode& node)
+	{
+		AABB bounds = EmptyBounds();
+		for (int slot = 0; slot < 4; slot++)
+		{
+			if (node.count[slot] >= 0)
+			{
+				bounds.min = glm::min(bounds.min, vec3(node.minX[slot], node.minY[slot], node.minZ[slot]));
+				bounds.max = glm::max(bounds.max, vec3(node.maxX[slot], node.maxY[slot], node.maxZ[slot]));
+			}
+		}
+		return bounds;
+	}
+
+	AABB LeafBounds(int first, int count) const
+	{
+		AABB bounds = EmptyBounds();
+		for (int i = first; i < first + count; i++)
+		{
+			Grow(bounds, primitiveBounds[primitiveOrder[i]]);
+		}
+		return bounds;
+	}
+
+	// Adds every primitive below a slot, used once a box is known to be inside the frustum
+	void AddSubtree(const BVHNode& node, int slot, vector<int>& results) const
+	{
+		if (node.count[slot] > 0)
+		{
+			results.insert(results.end(), primitiveOrder.begin() + node.child[slot], primitiveOrder.begin() + node.child[slot] + node.count[slot]);
+			return;
+		}
+
+		const BVHNode& child = nodes[node.child[slot]];
+		for (int childSlot = 0; childSlot < 4; childSlot++)
+		{
+			if (child.count[childSlot] >= 0)
+			{
+				AddSubtree(child, childSlot, results);
+			}
+		}
+	}
+
+	static bool Overlaps(const AABB& a, const AABB& b)
+	{
+		return a.min.x <= b.max.x && a.max.x >= b.min.x &&
+			   a.min.y <= b.max.y && a.max.y >= b.min.y &&
+			   a.min.z <= b.max.z && a.max.z >= b.min.z;
+	}
+
+	// A box is outside when its corner furthest along a plane's normal is behind that plane
+	static bool IsInFrustum(const AABB& bounds, const Frustum& frustum)
+	{
+		for (int p = 0; p < 6; p++)
+		{
+			const vec4& plane = frustum.planes[p];
+			vec3 farthest(plane.x >= 0.0f ? bounds.max.x : bounds.min.x,
+						  plane.y >= 0.0f ? bounds.max.y : bounds.min.y,
+						  plane.z >= 0.0f ? bounds.max.z : bounds.min.z);
+			if (dot(vec3(plane), farthest) + plane.w < 0.0f)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	static bool IntersectRay(const AABB& bounds, const Ray& ray, float maxDistance, float& enter)
+	{
+		vec3 t1 = (bounds.min - ray.origin) * ray.inverseDirection;
+		vec3 t2 = (bounds.max - ray.origin) * ray.inverseDirection;
+		vec3 entries = glm::min(t1, t2);
+		vec3 exits = glm::max(t1, t2);
+		enter = std::max(std::max(entries.x, entries.y), std::max(entries.z, 0.0f));
+		float exit = std::min(std::min(exits.x, exits.y), std::min(exits.z, maxDistance));
+		return enter <= exit;
+	}
+
+	// Bit per slot touching the frustum, insideMask gets the slots entirely inside it
+	static int TestFrustum(const BVHNode& node, const Frustum& frustum, int& insideMask)
+	{
+#ifdef USE_SSE
+		__m128 minX = _mm_loadu_ps(node.minX), minY = _mm_loadu_ps(node.minY), minZ = _mm_loadu_ps(node.minZ);
+		__m128 maxX = _mm_loadu_ps(node.maxX), maxY = _mm_loadu_ps(node.maxY), maxZ = _mm_loadu_ps(node.maxZ);
+		__m128 zero = _mm_setzero_ps();
+		__m128 outside = zero;
+		__m128 crossing = zero;
+
+		for (int p = 0; p < 6; p++)
+		{
+			const vec4& plane = frustum.planes[p];
+			__m128 planeX = _mm_set1_ps(plane.x), planeY = _mm_set1_ps(plane.y), planeZ = _mm_set1_ps(plane.z), planeW = _mm_set1_ps(plane.w);
+
+			// Corners furthest along and against the normal, picked per plane since its signs are the same for every lane
+			__m128 farDistance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX, plane.x >= 0.0f ? maxX : minX),
+													   _mm_mul_ps(planeY, plane.y >= 0.0f ? maxY : minY)),
+											_mm_add_ps(_mm_mul_ps(planeZ, plane.z >= 0.0f ? maxZ : minZ), planeW));
+			__m128 nearDistance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX, plane.x >= 0.0f ? minX : maxX),
+														_mm_mul_ps(planeY, plane.y >= 0.0f ? minY : maxY)),
+											 _mm_add_ps(_mm_mul_ps(planeZ, plane.z >= 0.0f ? minZ : maxZ), planeW));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(farDistance, zero));
+			crossing = _mm_or_ps(crossing, _mm_cmplt_ps(nearDistance, zero));
+		}
+
+		int hitMask = ~_mm_movemask_ps(outside) & 15;
+		insideMask = hitMask & ~_mm_movemask_ps(crossing);
+		return hitMask;
+#else
+		int hitMask = 0;
+		insideMask = 0;
+		for (int slot = 0; slot < 4; slot++)
+		{
+			AABB bounds;
+			bounds.min = vec3(node.minX[slot], node.minY[slot], node.minZ[slot]);
+			bounds.max = vec3(node.maxX[slot], node.maxY[slot], node.maxZ[slot]);
+			if (!IsInFrustum(bounds, frustum))
+			{
+				continue;
+			}
+			hitMask |= 1 << slot;
+
+			bool inside = true;
+			for (int p = 0; p < 6 && inside; p++)
+			{
+				const vec4& plane = frustum.planes[p];
+				vec3 nearest(plane.x >= 0.0f ? bounds.min.x : bounds.max.x,
+							 plane.y >= 0.0f ? bounds.min.y : bounds.max.y,
+							 plane.z >= 0.0f ? bounds.min.z : bounds.max.z);
+				inside = dot(vec3(plane), nearest) + plane.w >= 0.0f;
+			}
+			insideMask |= inside ? 1 << slot : 0;
+		}
+		return hitMask;
+#endif
+	}
+
+	static int TestBox(const BVHNode& node, const AABB& box)
+	{
+#ifdef USE_SSE
+		__m128 overlap = _mm_and_ps(_mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(node.minX), _mm_set1_ps(box.max.x)),
+											   _mm_cmpge_ps(_mm_loadu_ps(node.maxX), _mm_set1_ps(box.min.x))),
+									_mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(node.minY), _mm_set1_ps(box.max.y)),
+											   _mm_cmpge_ps(_mm_loadu_ps(node.maxY), _mm_set1_ps(box.min.y))));
+		overlap = _mm_and_ps(overlap, _mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(node.minZ), _mm_set1_ps(box.max.z)),
+												 _mm_cmpge_ps(_mm_loadu_ps(node.maxZ), _mm_set1_ps(box.min.z))));
+		return _mm_movemask_ps(overlap);
+#else
+		int hitMask = 0;
+		for (int slot = 0; slot < 4; slot++)
+		{
+			if (node.minX[slot] <= box.max.x && node.maxX[slot] >= box.min.x &&
+				node.minY[slot] <= box.max.y && node.maxY[slot] >= box.min.y &&
+				node.minZ[slot] <= box.max.z && node.maxZ[slot] >= box.min.z)
+			{
+				hitMask |= 1 << slot;
+			}
+		}
+		return hitMask;
+#endif
+	}
+
+	// Slab test against the four child boxes, enter gets each hit box's entry distance
+	static int TestRay(const BVHNode& node, const Ray& ray, float maxDistance, float enter[4])
+	{
+#ifdef USE_SSE
+		__m128 originX = _mm_set1_ps(ray.origin.x), originY = _mm_set1_ps(ray.origin.y), originZ = _mm_set1_ps(ray.origin.z);
+		__m128 inverseX = _mm_set1_ps(ray.inverseDirection.x), inverseY = _mm_set1_ps(ray.inverseDirection.y), inverseZ = _mm_set1_ps(ray.inverseDirection.z);
+
+		__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minX), originX), inverseX);
+		__m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxX), originX), inverseX);
+		__m128 entry = _mm_max_ps(_mm_min_ps(t1, t2), _mm_setzero_ps());
+		__m128 exit = _mm_min_ps(_mm_max_ps(t1, t2), _mm_set1_ps(maxDistance));
+
+		t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minY), originY), inverseY);
+		t2 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxY), originY), inverseY);
+		entry = _mm_max_ps(entry, _mm_min_ps(t1, t2));
+		exit = _mm_min_ps(exit, _mm_max_ps(t1, t2));
+
+		t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minZ), originZ), inverseZ);
+		t2 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxZ), originZ), inverseZ);
+		entry = _mm_max_ps(entry, _mm_min_ps(t1, t2));
+		exit = _mm_min_ps(exit, _mm_max_ps(t1, t2));
+
+		_mm_storeu_ps(enter, entry);
+		return _mm_movemask_ps(_mm_cmple_ps(entry, exit));
+#else
+		int hitMask = 0;
+		for (int slot = 0; slot < 4; slot++)
+		{
+			AABB bounds;
+			bounds.min = vec3(node.minX[slot], node.minY[slot], node.minZ[slot]);
+			bounds.max = vec3(node.maxX[slot], node.maxY[slot], node.maxZ[slot]);
+			hitMask |= IntersectRay(bounds, ray, maxDistance, enter[slot]) ? 1 << slot : 0;
+		}
+		return hitMask;
+#endif
+	}
+};
+
+#endif
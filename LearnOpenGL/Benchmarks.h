@@ -0,0 +1,622 @@
+#ifndef BENCHMARKS_H
+#define BENCHMARKS_H
+
+#include "BVH.h"
+#include "EntityWorld.h"
+#include "JobSystem.h"
+#include "MeshBuilder.h"
+#include "Meshlets.h"
+#include "MeshSimplifier.h"
+#include "OcclusionCuller.h"
+#include "RenderQueue.h"
+#include "SceneGraph.h"
+#include "TransformStore.h"
+
+#include <glm/glm/glm.hpp>
+#include <glm/glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+// CPU side micro benchmarks, run with the --benchmark command line argument, no GL context needed
+class Benchmarks
+{
+public:
+	static void Run()
+	{
+		RenderQueueSort();
+		JobSpawnThroughput();
+		JobStealThroughput();
+		JobParallelFor();
+		TransformKernel();
+		SceneGraphUpdate();
+		EntityIteration();
+		BVHQueries();
+		OcclusionRasterizer();
+		MeshSimplification();
+		MeshletCulling();
+
+		// Joins the workers the benchmarks started, exiting with them still running aborts or hangs
+		JobSystem::Shutdown();
+	}
+
+	// Radix sorted render queue against std::sort on the same keys
+	static void RenderQueueSort()
+	{
+		cout << "Render queue sort" << endl;
+
+		int drawCounts[] = { 10000, 100000, 1000000 };
+		for (int drawCount : drawCounts)
+		{
+			// Few shaders and arenas, more textures and meshes, random depths, like a real scene
+			mt19937 random(drawCount);
+			RenderQueue queue;
+			vector<RenderItem> items(drawCount);
+			for (int i = 0; i < drawCount; i++)
+			{
+				float depth = (random() & 0xFFFF) / 65535.0f;
+				unsigned int shader = random() % 4;
+				unsigned int arena = random() % 2;
+				unsigned int texture = random() % 64;
+				unsigned int mesh = random() % 256;
+
+				items[i].key = (random() % 8 == 0) ? RenderQueue::MakeTransparentKey(shader, arena, texture, mesh, depth)
+												   : RenderQueue::MakeOpaqueKey(shader, arena, texture, mesh, depth);
+				items[i].index = i;
+			}
+
+			const int iterations = drawCount >= 1000000 ? 5 : 20;
+			double radixTime = 0.0;
+			double stdSortTime = 0.0;
+			bool matches = true;
+			for (int iteration = 0; iteration < iterations; iteration++)
+			{
+				queue.Clear();
+				for (int i = 0; i < drawCount; i++)
+				{
+					queue.Submit(items[i].key, items[i].index);
+				}
+
+				chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+				queue.Sort();
+				radixTime += Milliseconds(start);
+
+				vector<RenderItem> sorted = items;
+				start = chrono::high_resolution_clock::now();
+				stable_sort(sorted.begin(), sorted.end(), [](const RenderItem& a, const RenderItem& b) { return a.key < b.key; });
+				stdSortTime += Milliseconds(start);
+
+				const vector<RenderItem>& queueItems = queue.GetItems();
+				for (int i = 0; i < drawCount && matches; i++)
+				{
+					matches = queueItems[i].key == sorted[i].key && queueItems[i].index == sorted[i].index;
+				}
+			}
+
+			cout << "  " << drawCount << " draws: radix " << radixTime / iterations << " ms, std::stable_sort "
+				 << stdSortTime / iterations << " ms" << (matches ? "" : " (ORDER MISMATCH)") << endl;
+		}
+	}
+
+	// Empty jobs spawned from the main thread and run by every worker, measures the per-job overhead
+	static void JobSpawnThroughput()
+	{
+		JobSystem::Initialize();
+		const int jobCount = 1000000;
+		const int batchSize = 2048; // Stays under the job pool size
+		atomic<int> executed(0);
+
+		JobSystem::ResetWorkerStats();
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		for (int batch = 0; batch < jobCount; batch += batchSize)
+		{
+			JobCounter counter;
+			for (int i = 0; i < batchSize; i++)
+			{
+				JobSystem::Spawn([&executed]() { executed.fetch_add(1, memory_order_relaxed); }, &counter);
+			}
+			JobSystem::Wait(counter);
+		}
+		double time = Milliseconds(start);
+
+		cout << "Job spawn (" << JobSystem::GetWorkerCount() << " workers)" << endl;
+		cout << "  " << executed.load() << " empty jobs: " << time << " ms, " << jobCount / time / 1000.0 << " M jobs/s, "
+			 << StolenPercentage() << "% stolen" << endl;
+	}
+
+	// Jobs with some work spawned from a single worker, idle workers have to steal everything they run
+	static void JobStealThroughput()
+	{
+		JobSystem::Initialize();
+		const int jobCount = 200000;
+		const int batchSize = 2048;
+		atomic<int> executed(0);
+
+		JobSystem::ResetWorkerStats();
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		for (int batch = 0; batch < jobCount; batch += batchSize)
+		{
+			JobCounter counter;
+			for (int i = 0; i < batchSize; i++)
+			{
+				JobSystem::Spawn([&executed, i]()
+				{
+					float value = (float)i;
+					for (int iteration = 0; iteration < 200; iteration++)
+					{
+						value = sqrt(value + 1.0f);
+					}
+					executed.fetch_add(value > 0.0f ? 1 : 0, memory_order_relaxed);
+				}, &counter);
+			}
+			JobSystem::Wait(counter);
+		}
+		double time = Milliseconds(start);
+
+		long long stolenJobs = 0;
+		for (int i = 0; i < JobSystem::GetWorkerCount(); i++)
+		{
+			stolenJobs += JobSystem::GetWorkerStats(i).stolenJobs;
+		}
+		cout << "Job steal" << endl;
+		cout << "  " << executed.load() << " small jobs: " << time << " ms, " << stolenJobs / time / 1000.0 << " M steals/s, "
+			 << StolenPercentage() << "% stolen" << endl;
+	}
+
+	// Fine grained parallel loop against the same loop on one thread
+	static void JobParallelFor()
+	{
+		JobSystem::Initialize();
+		const int count = 1 << 22;
+		vector<float> values(count, 2.0f);
+
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		for (int i = 0; i < count; i++)
+		{
+			values[i] = sqrt(values[i] * values[i] + 1.0f);
+		}
+		double serialTime = Milliseconds(start);
+
+		cout << "Parallel for (" << count << " elements)" << endl;
+		cout << "  serial: " << serialTime << " ms" << endl;
+		int grainSizes[] = { 256, 4096, 65536 };
+		for (int grainSize : grainSizes)
+		{
+			start = chrono::high_resolution_clock::now();
+			JobSystem::ParallelFor(count, grainSize, [&values](int begin, int end)
+			{
+				for (int i = begin; i < end; i++)
+				{
+					values[i] = sqrt(values[i] * values[i] + 1.0f);
+				}
+			});
+			double time = Milliseconds(start);
+			cout << "  grain " << grainSize << ": " << time << " ms, " << serialTime / time << "x" << endl;
+		}
+	}
+
+	// TRS to matrix kernel on one thread and split across the workers, checked against the scalar version
+	static void TransformKernel()
+	{
+		JobSystem::Initialize();
+		const int count = 1000000;
+		const int iterations = 10;
+
+		mt19937 random(count);
+		uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+		TransformStore transforms;
+		for (int i = 0; i < count; i++)
+		{
+			vec3 axis = normalize(vec3(distribution(random), distribution(random), distribution(random)) + vec3(0.0f, 0.0f, 2.0f));
+			transforms.Add(vec3(distribution(random), distribution(random), distribution(random)) * 100.0f,
+						   angleAxis(distribution(random) * 3.14159f, axis),
+						   vec3(1.0f) + vec3(distribution(random), distribution(random), distribution(random)) * 0.5f);
+		}
+		vector<mat4> matrices(count);
+
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		for (int iteration = 0; iteration < iterations; iteration++)
+		{
+			transforms.ComputeMatrices(0, count, matrices.data());
+		}
+		double singleTime = Milliseconds(start) / iterations;
+
+		start = chrono::high_resolution_clock::now();
+		for (int iteration = 0; iteration < iterations; iteration++)
+		{
+			transforms.ComputeMatrices(matrices.data());
+		}
+		double parallelTime = Milliseconds(start) / iterations;
+
+		// 64 MB of output is far past the cache, the case non-temporal stores are meant for
+		start = chrono::high_resolution_clock::now();
+		for (int iteration = 0; iteration < iterations; iteration++)
+		{
+			transforms.ComputeMatrices(0, count, matrices.data(), true);
+		}
+		double streamedTime = Milliseconds(start) / iterations;
+
+		float maxError = 0.0f;
+		for (int i = 0; i < count; i += 97)
+		{
+			mat4 expected = transforms.ComputeMatrix(i);
+			for (int column = 0; column < 4; column++)
+			{
+				for (int row = 0; row < 4; row++)
+				{
+					maxError = std::max(maxError, abs(matrices[i][column][row] - expected[column][row]));
+				}
+			}
+		}
+
+		cout << "Transform kernel (" << count << " transforms)" << endl;
+		// Each matrix is 64 bytes of output, so the rate is bound by write bandwidth long before arithmetic
+		cout << "  1 thread: " << singleTime << " ms, " << count / singleTime / 1000000.0 << " M transforms/ms, "
+			 << count * sizeof(mat4) / singleTime / 1000000.0 << " GB/s written" << endl;
+		cout << "  1 thread streamed: " << streamedTime << " ms, " << count / streamedTime / 1000000.0 << " M transforms/ms, "
+			 << count * sizeof(mat4) / streamedTime / 1000000.0 << " GB/s written" << endl;
+		cout << "  " << JobSystem::GetWorkerCount() << " workers: " << parallelTime << " ms, max error against scalar " << maxError << endl;
+	}
+
+	// Large static hierarchy with a small animated fraction, incremental update against recomputing every node
+	static void SceneGraphUpdate()
+	{
+		const int rootCount = 1000;
+		const int childrenPerNode = 10; // Three levels below each root, 1.1 M nodes in total
+		const int iterations = 10;
+
+		mt19937 random(rootCount);
+		uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+		SceneGraph scene;
+		vector<int> nodes;
+		vector<int> level;
+		for (int i = 0; i < rootCount; i++)
+		{
+			level.push_back(scene.CreateNode(-1, translate(mat4(1.0f), vec3(distribution(random), 0.0f, distribution(random)) * 1000.0f)));
+		}
+		for (int depth = 0; depth < 3; depth++)
+		{
+			vector<int> nextLevel;
+			for (int parent : level)
+			{
+				for (int i = 0; i < childrenPerNode; i++)
+				{
+					nextLevel.push_back(scene.CreateNode(parent, translate(mat4(1.0f), vec3(distribution(random), distribution(random), distribution(random)))));
+				}
+			}
+			nodes.insert(nodes.end(), level.begin(), level.end());
+			level.swap(nextLevel);
+		}
+		nodes.insert(nodes.end(), level.begin(), level.end());
+		scene.Update();
+
+		cout << "Scene graph update (" << scene.GetNodeCount() << " nodes)" << endl;
+		float animatedFractions[] = { 1.0f, 0.01f, 0.001f };
+		for (float animatedFraction : animatedFractions)
+		{
+			int animatedCount = (int)(scene.GetNodeCount() * animatedFraction);
+			double time = 0.0;
+			int updatedCount = 0;
+			for (int iteration = 0; iteration < iterations; iteration++)
+			{
+				chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+				for (int i = 0; i < animatedCount; i++)
+				{
+					int node = nodes[random() % nodes.size()];
+					scene.SetLocalMatrix(node, rotate(scene.GetLocalMatrix(node), 0.01f, vec3(0.0f, 1.0f, 0.0f)));
+				}
+				scene.Update();
+				time += Milliseconds(start);
+				updatedCount += scene.GetUpdatedCount();
+			}
+
+			cout << "  " << animatedFraction * 100.0f << "% animated: " << time / iterations << " ms, "
+				 << updatedCount / iterations << " world matrices recomputed" << endl;
+		}
+	}
+
+	// Bounding sphere transform over every entity's chunk arrays, the access pattern of culling
+	static void EntityIteration()
+	{
+		JobSystem::Initialize();
+		const int count = 1000000;
+		const int iterations = 10;
+
+		mt19937 random(count);
+		uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+		EntityWorld entities;
+		for (int i = 0; i < count; i++)
+		{
+			TransformComponent transform = { translate(mat4(1.0f), vec3(distribution(random), distribution(random), distribution(random)) * 100.0f), -1 };
+			BoundsComponent bounds = { { vec3(0.0f), 1.0f }, -1 };
+			MaterialComponent material = { 0, 0 };
+			entities.CreateEntity(transform, bounds, material);
+		}
+
+		// Sums the centers so the loop is not optimized away
+		vector<vec3> chunkSums(entities.CountChunks<TransformComponent, BoundsComponent>());
+		auto transformBounds = [&chunkSums](int chunkIndex, int chunkCount, TransformComponent* transforms, BoundsComponent* bounds)
+		{
+			vec3 sum(0.0f);
+			for (int i = 0; i < chunkCount; i++)
+			{
+				sum += vec3(transforms[i].worldMatrix * vec4(bounds[i].sphere.center, 1.0f));
+			}
+			chunkSums[chunkIndex] = sum;
+		};
+
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		for (int iteration = 0; iteration < iterations; iteration++)
+		{
+			int chunkIndex = 0;
+			entities.ForEachChunk<TransformComponent, BoundsComponent>([&](int chunkCount, TransformComponent* transforms, BoundsComponent* bounds)
+			{
+				transformBounds(chunkIndex++, chunkCount, transforms, bounds);
+			});
+		}
+		double serialTime = Milliseconds(start) / iterations;
+
+		start = chrono::high_resolution_clock::now();
+		for (int iteration = 0; iteration < iterations; iteration++)
+		{
+			entities.ParallelForEachChunk<TransformComponent, BoundsComponent>(transformBounds);
+		}
+		double parallelTime = Milliseconds(start) / iterations;
+
+		cout << "Entity iteration (" << count << " entities, " << entities.GetChunkCapacity<TransformComponent, BoundsComponent, MaterialComponent>()
+			 << " per chunk)" << endl;
+		cout << "  1 thread: " << serialTime << " ms, " << JobSystem::GetWorkerCount() << " workers: " << parallelTime << " ms" << endl;
+	}
+
+	// Build, refit and query times over a large world of boxes, frustum culling compared against the flat sphere culler
+	static void BVHQueries()
+	{
+		const int count = 1000000;
+		const int queryCount = 1000;
+
+		mt19937 random(count);
+		uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+		vector<AABB> bounds(count);
+		for (int i = 0; i < count; i++)
+		{
+			vec3 center = vec3(distribution(random), distribution(random) * 0.05f, distribution(random)) * 2000.0f;
+			vec3 extents = vec3(1.0f) + vec3(distribution(random), distribution(random), distribution(random)) * 0.5f;
+			bounds[i].min = center - extents;
+			bounds[i].max = center + extents;
+		}
+
+		cout << "BVH (" << count << " boxes)" << endl;
+		BVH bvh;
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		bvh.Build(bounds);
+		cout << "  build: " << Milliseconds(start) << " ms, " << bvh.GetNodeCount() << " nodes" << endl;
+
+		float movedFractions[] = { 0.01f, 1.0f };
+		for (float movedFraction : movedFractions)
+		{
+			int movedCount = (int)(count * movedFraction);
+			for (int i = 0; i < movedCount; i++)
+			{
+				int primitive = movedFraction < 1.0f ? random() % count : i;
+				AABB moved = bvh.GetBounds(primitive);
+				vec3 offset = vec3(distribution(random), distribution(random), distribution(random)) * 0.5f;
+				moved.min += offset;
+				moved.max += offset;
+				bvh.SetBounds(primitive, moved);
+			}
+
+			start = chrono::high_resolution_clock::now();
+			bvh.Refit();
+			cout << "  refit after moving " << movedFraction * 100.0f << "%: " << Milliseconds(start) << " ms" << endl;
+		}
+
+		// Cameras near the ground looking across the world, they see a small part of it
+		Frustum frustums[16];
+		for (int i = 0; i < 16; i++)
+		{
+			vec3 eye = vec3(distribution(random) * 1000.0f, 20.0f, distribution(random) * 1000.0f);
+			mat4 view = lookAt(eye, eye + vec3(distribution(random), 0.0f, distribution(random)), vec3(0.0f, 1.0f, 0.0f));
+			frustums[i] = Frustum::FromMatrix(perspective(radians(45.0f), 4.0f / 3.0f, 0.1f, 500.0f) * view);
+		}
+
+		vector<int> visible;
+		int visibleTotal = 0;
+		start = chrono::high_resolution_clock::now();
+		for (int i = 0; i < 16; i++)
+		{
+			bvh.QueryFrustum(frustums[i], visible);
+			visibleTotal += (int)visible.size();
+		}
+		double bvhTime = Milliseconds(start) / 16;
+
+		FrustumCuller culler;
+		for (int i = 0; i < count; i++)
+		{
+			const AABB& primitiveBounds = bvh.GetBounds(i);
+			culler.AddSphere(primitiveBounds.GetCenter(), length(primitiveBounds.GetExtents()));
+		}
+		start = chrono::high_resolution_clock::now();
+		for (int i = 0; i < 16; i++)
+		{
+			culler.Cull(frustums[i], visible);
+		}
+		double flatTime = Milliseconds(start) / 16;
+		cout << "  frustum query: " << bvhTime << " ms (" << visibleTotal / 16 << " visible), flat sphere culling: " << flatTime << " ms" << endl;
+
+		int hitCount = 0;
+		start = chrono::high_resolution_clock::now();
+		for (int i = 0; i < queryCount; i++)
+		{
+			vec3 origin = vec3(distribution(random) * 2000.0f, 10.0f, distribution(random) * 2000.0f);
+			float distance = 1000.0f;
+			hitCount += bvh.Raycast(origin, normalize(vec3(distribution(random), -0.05f, distribution(random))), distance) != -1 ? 1 : 0;
+		}
+		cout << "  raycast: " << Milliseconds(start) * 1000.0 / queryCount << " us, " << hitCount << " of " << queryCount << " hit" << endl;
+
+		int overlapTotal = 0;
+		start = chrono::high_resolution_clock::now();
+		for (int i = 0; i < queryCount; i++)
+		{
+			AABB box;
+			box.min = vec3(distribution(random) * 2000.0f, -50.0f, distribution(random) * 2000.0f);
+			box.max = box.min + vec3(50.0f, 100.0f, 50.0f);
+			bvh.QueryBox(box, visible);
+			overlapTotal += (int)visible.size();
+		}
+		cout << "  box query: " << Milliseconds(start) * 1000.0 / queryCount << " us, " << overlapTotal / queryCount << " overlaps on average" << endl;
+	}
+
+	// Rows of wall occluders in front of a field of boxes, rasterization and box tests timed separately
+	static void OcclusionRasterizer()
+	{
+		JobSystem::Initialize();
+		const int wallCount = 64;
+		const int boxCount = 100000;
+		const int iterations = 20;
+
+		// Unit cube, each wall is a flattened one
+		const float cubeVertices[] =
+		{
+			-0.5f, -0.5f, -0.5f,  0.5f, -0.5f, -0.5f,  0.5f, 0.5f, -0.5f,  -0.5f, 0.5f, -0.5f,
+			-0.5f, -0.5f, 0.5f,   0.5f, -0.5f, 0.5f,   0.5f, 0.5f, 0.5f,   -0.5f, 0.5f, 0.5f
+		};
+		const unsigned int cubeIndices[] =
+		{
+			0, 2, 1, 0, 3, 2,  4, 5, 6, 4, 6, 7,  0, 1, 5, 0, 5, 4,
+			3, 7, 6, 3, 6, 2,  0, 4, 7, 0, 7, 3,  1, 2, 6, 1, 6, 5
+		};
+
+		mt19937 random(boxCount);
+		uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+		vector<mat4> walls(wallCount);
+		for (int i = 0; i < wallCount; i++)
+		{
+			vec3 position(distribution(random) * 40.0f, 0.0f, -10.0f - (distribution(random) + 1.0f) * 10.0f);
+			walls[i] = scale(translate(mat4(1.0f), position), vec3(8.0f, 6.0f, 0.5f));
+		}
+		vector<AABB> boxes(boxCount);
+		for (int i = 0; i < boxCount; i++)
+		{
+			vec3 center(distribution(random) * 60.0f, distribution(random) * 2.0f, -35.0f - (distribution(random) + 1.0f) * 30.0f);
+			boxes[i] = AABB::FromSphere(center, 0.5f);
+		}
+
+		mat4 viewProjection = perspective(radians(60.0f), 2.0f, 0.1f, 200.0f) * lookAt(vec3(0.0f, 0.0f, 5.0f), vec3(0.0f, 0.0f, -10.0f), vec3(0.0f, 1.0f, 0.0f));
+		OcclusionCuller culler;
+
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		for (int iteration = 0; iteration < iterations; iteration++)
+		{
+			culler.Begin(viewProjection);
+			for (int i = 0; i < wallCount; i++)
+			{
+				culler.AddOccluder(cubeVertices, 8, 3, cubeIndices, 36, walls[i]);
+			}
+			culler.Rasterize();
+		}
+		double rasterizeTime = Milliseconds(start) / iterations;
+
+		atomic<int> occludedCount(0);
+		start = chrono::high_resolution_clock::now();
+		JobSystem::ParallelFor(boxCount, 4096, [&](int begin, int end)
+		{
+			int occluded = 0;
+			for (int i = begin; i < end; i++)
+			{
+				occluded += culler.IsOccluded(boxes[i]) ? 1 : 0;
+			}
+			occludedCount.fetch_add(occluded);
+		});
+		double testTime = Milliseconds(start);
+
+		cout << "Occlusion culling (" << OcclusionCuller::WIDTH << "x" << OcclusionCuller::HEIGHT << ", " << culler.GetOccluderTriangleCount() << " occluder triangles)" << endl;
+		cout << "  rasterize: " << rasterizeTime << " ms, test " << boxCount << " boxes: " << testTime << " ms, "
+			 << occludedCount.load() << " occluded" << endl;
+	}
+
+	// A LOD chain of a dense sphere, each level from the previous one like Object builds them
+	static void MeshSimplification()
+	{
+		const int lodCount = 5;
+		vector<float> vertices;
+		vector<unsigned int> indices;
+		MeshBuilder::Sphere(128, 256, vertices, indices);
+
+		cout << "Mesh simplification (" << indices.size() / 3 << " triangles)" << endl;
+		vector<unsigned int> previous = indices;
+		for (int lod = 1; lod < lodCount; lod++)
+		{
+			float error;
+			chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+			vector<unsigned int> simplified = MeshSimplifier::Simplify(vertices, 5, previous, previous.size() / 6 * 3, FLT_MAX, error);
+			double time = Milliseconds(start);
+
+			cout << "  lod " << lod << ": " << simplified.size() / 3 << " triangles, error " << error << ", " << time << " ms" << endl;
+			previous.swap(simplified);
+		}
+	}
+
+	// Frustum and normal cone tests of every meshlet of a dense sphere, placed at random around the camera
+	static void MeshletCulling()
+	{
+		const int instanceCount = 10000;
+		vector<float> vertices;
+		vector<unsigned int> indices;
+		MeshBuilder::Sphere(64, 128, vertices, indices);
+		vector<Meshlet> meshlets = MeshletBuilder::Build(vertices, 5, indices);
+		MeshletCuller culler;
+		culler.SetMeshlets(meshlets);
+
+		mt19937 random(instanceCount);
+		uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+		vector<mat4> models(instanceCount);
+		for (int i = 0; i < instanceCount; i++)
+		{
+			vec3 position(distribution(random) * 20.0f, distribution(random) * 20.0f, -distribution(random) * 20.0f - 25.0f);
+			models[i] = rotate(translate(mat4(1.0f), position), distribution(random) * 3.14f, vec3(0.0f, 1.0f, 0.0f));
+		}
+
+		vec3 cameraPosition(0.0f, 0.0f, 5.0f);
+		Frustum frustum = Frustum::FromMatrix(perspective(radians(60.0f), 2.0f, 0.1f, 200.0f) * lookAt(cameraPosition, vec3(0.0f, 0.0f, -10.0f), vec3(0.0f, 1.0f, 0.0f)));
+		vector<IndexRange> ranges;
+		long long visibleCount = 0;
+
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		for (int i = 0; i < instanceCount; i++)
+		{
+			visibleCount += culler.Cull(models[i], frustum, cameraPosition, true, ranges);
+		}
+		double time = Milliseconds(start);
+
+		long long meshletCount = (long long)instanceCount * culler.GetMeshletCount();
+		cout << "Meshlet culling (" << indices.size() / 3 << " triangles in " << culler.GetMeshletCount() << " meshlets)" << endl;
+		cout << "  " << instanceCount << " instances: " << time << " ms, " << 100.0 * (meshletCount - visibleCount) / meshletCount << "% of meshlets culled" << endl;
+	}
+
+private:
+	static double StolenPercentage()
+	{
+		long long executedJobs = 0;
+		long long stolenJobs = 0;
+		for (int i = 0; i < JobSystem::GetWorkerCount(); i++)
+		{
+			JobSystem::WorkerStats stats = JobSystem::GetWorkerStats(i);
+			executedJobs += stats.executedJobs;
+			stolenJobs += stats.stolenJobs;
+		}
+		return executedJobs == 0 ? 0.0 : 100.0 * stolenJobs / executedJobs;
+	}
+
+	static double Milliseconds(chrono::high_resolution_clock::time_point start)
+	{
+		return chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+	}
+};
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef BOUNDS_H
+#define BOUNDS_H
+
+#include <glm/glm/glm.hpp>
+
+using namespace glm;
+
+// Axis aligned bounding box
+struct AABB
+{
+	vec3 min;
+	vec3 max;
+
+	vec3 GetCenter() const
+	{
+		return (min + max) * 0.5f;
+	}
+
+	vec3 GetExtents() const
+	{
+		return (max - min) * 0.5f;
+	}
+
+	static AABB FromSphere(const vec3& center, float radius)
+	{
+		AABB bounds;
+		bounds.min = center - vec3(radius);
+		bounds.max = center + vec3(radius);
+		return bounds;
+	}
+
+	// Positions are the first three floats of every vertex
+	static AABB FromVertices(const float* vertices, int vertexCount, int stride)
+	{
+		AABB bounds;
+		bounds.min = vec3(0.0f);
+		bounds.max = vec3(0.0f);
+		if (vertexCount == 0)
+		{
+			return bounds;
+		}
+
+		bounds.min = vec3(vertices[0], vertices[1], vertices[2]);
+		bounds.max = bounds.min;
+		for (int i = 1; i < vertexCount; i++)
+		{
+			vec3 position(vertices[i * stride], vertices[i * stride + 1], vertices[i * stride + 2]);
+			bounds.min = glm::min(bounds.min, position);
+			bounds.max = glm::max(bounds.max, position);
+		}
+
+		return bounds;
+	}
+};
+
+struct BoundingSphere
+{
+	vec3 center;
+	float radius;
+
+	// Encloses the box, not the tightest sphere but stable under rotation about its center
+	static BoundingSphere FromAABB(const AABB& bounds)
+	{
+		BoundingSphere sphere;
+		sphere.center = bounds.GetCenter();
+		sphere.radius = length(bounds.GetExtents());
+		return sphere;
+	}
+};
+
+#endif
@@ -23,30 +23,87 @@ public:
 		right = vec3(1.0f, 0.0f, 0.0f);
 		up = vec3(0.0f, 1.0f, 0.0f);
 		forward = vec3(0.0f, 0.0f, 1.0f);
+
+		projectionMatrix = mat4(1.0f);
+		farPlaneDistance = 1.0f;
+		viewDirty = true;
+		viewProjectionDirty = true;
 	}
 
-	mat4 GetViewMatrix()
+	// Rebuilt only when position, up or forward changed since the last call
+	const mat4& GetViewMatrix()
 	{
-		return lookAt(position, vec3(0.0f, 0.0f, 0.0f), up);
+		if (viewDirty || position != viewPosition || up != viewUp || forward != viewForward)
+		{
+			viewMatrix = lookAt(position, vec3(0.0f, 0.0f, 0.0f), up);
+
+			viewPosition = position;
+			viewUp = up;
+			viewForward = forward;
+			viewDirty = false;
+			viewProjectionDirty = true;
+		}
+
+		return viewMatrix;
 	}
 
 	void SetOrthographicProjection(float width, float height, float nearPlaneDistance, float farPlaneDistance)
 	{
 		projectionMatrix = ortho(-(width / 2), width / 2, -(height / 2), height / 2, nearPlaneDistance, farPlaneDistance);
+		this->farPlaneDistance = farPlaneDistance;
+		viewProjectionDirty = true;
 	}
 
 	void SetPerspectiveProjection(float screenWidth, float screenHeight, float nearPlaneDistance, float farPlaneDistance, float fieldOfView)
 	{
 		projectionMatrix = perspective(fieldOfView, screenWidth / screenHeight, nearPlaneDistance, farPlaneDistance);
+		this->farPlaneDistance = farPlaneDistance;
+		viewProjectionDirty = true;
 	}
 
-	mat4 GetProjectionMatrix()
+	const mat4& GetProjectionMatrix()
 	{
 		return projectionMatrix;
 	}
 
+	float GetFarPlaneDistance()
+	{
+		return farPlaneDistance;
+	}
+
+	// View space distance of a world position along the view direction, divided by the far plane distance
+	// Takes an already resolved view matrix, so recording jobs can call it without touching the camera
+	static float GetNormalizedDepth(const mat4& viewMatrix, float farPlaneDistance, const vec3& worldPosition)
+	{
+		return -(viewMatrix * vec4(worldPosition, 1.0f)).z / farPlaneDistance;
+	}
+
+	// Projection * View, rebuilt only when either of them changed
+	const mat4& GetViewProjectionMatrix()
+	{
+		GetViewMatrix();
+		if (viewProjectionDirty)
+		{
+			viewProjectionMatrix = projectionMatrix * viewMatrix;
+			viewProjectionDirty = false;
+		}
+
+		return viewProjectionMatrix;
+	}
+
 private:
 	mat4 projectionMatrix;
+	mat4 viewMatrix;
+	mat4 viewProjectionMatrix;
+	float farPlaneDistance;
+
+	// Camera basis the cached view matrix was built from
+	vec3 viewPosition;
+	vec3 viewUp;
+	vec3 viewForward;
+
+	bool viewDirty;
+	bool viewProjectionDirty;
 };
 
 #endif
\ No newline at end of file
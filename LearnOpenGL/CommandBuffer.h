@@ -0,0 +1,285 @@
+#ifndef COMMAND_BUFFER_H
+#define COMMAND_BUFFER_H
+
+#include "Meshlets.h"
+
+#include <glm/glm/glm.hpp>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+using namespace glm;
+
+class Object;
+class Shader;
+template <typename T> struct UniformHandle;
+
+enum CommandType
+{
+	BIND_PIPELINE_COMMAND,
+	BIND_TEXTURE_COMMAND,
+	SET_UNIFORM_COMMAND,
+	DRAW_COMMAND,
+	DRAW_INSTANCES_COMMAND,
+	DRAW_RANGES_COMMAND,
+	DRAW_INSTANCE_RANGES_COMMAND,
+	OCCLUSION_QUERY_COMMAND
+};
+
+// Fixed function state bound along with a shader
+struct PipelineState
+{
+	bool depthTest;
+	bool depthWrite;
+	bool blend;	   // Alpha blending
+	bool cullFace; // Back faces, counter clockwise triangles are the front
+
+	PipelineState(bool depthTest = true, bool depthWrite = true, bool blend = false, bool cullFace = false)
+	{
+		this->depthTest = depthTest;
+		this->depthWrite = depthWrite;
+		this->blend = blend;
+		this->cullFace = cullFace;
+	}
+};
+
+enum UniformValueType
+{
+	BOOL_UNIFORM,
+	INT_UNIFORM,
+	FLOAT_UNIFORM,
+	VEC3_UNIFORM,
+	VEC4_UNIFORM,
+	MAT4_UNIFORM
+};
+
+template <typename T> struct UniformValue;
+template <> struct UniformValue<bool> { static const UniformValueType type = BOOL_UNIFORM; };
+template <> struct UniformValue<int> { static const UniformValueType type = INT_UNIFORM; };
+template <> struct UniformValue<float> { static const UniformValueType type = FLOAT_UNIFORM; };
+template <> struct UniformValue<vec3> { static const UniformValueType type = VEC3_UNIFORM; };
+template <> struct UniformValue<vec4> { static const UniformValueType type = VEC4_UNIFORM; };
+template <> struct UniformValue<mat4> { static const UniformValueType type = MAT4_UNIFORM; };
+
+// Command layouts in the stream, each preceded by a CommandHeader
+struct CommandHeader
+{
+	uint32_t type;
+	uint32_t size; // Of the whole command, header included
+};
+
+struct BindPipelineCommand
+{
+	Shader* shader;
+	PipelineState state;
+};
+
+struct BindTextureCommand
+{
+	uint32_t unit;
+	uint32_t texture;
+};
+
+struct SetUniformCommand
+{
+	int32_t location;
+	uint32_t type; // UniformValueType
+	unsigned char value[sizeof(mat4)];
+};
+
+struct DrawCommand
+{
+	Object* object;
+	int occlusionSlot; // Hardware occlusion slot whose previous query gates the draw, -1 for none
+	int lod;
+};
+
+// Followed by instanceCount model matrices
+struct DrawInstancesCommand
+{
+	Object* object;
+	uint32_t instanceCount;
+	int lod;
+};
+
+// Followed by rangeCount index ranges of the object's level 0
+struct DrawRangesCommand
+{
+	Object* object;
+	int occlusionSlot;
+	uint32_t rangeCount;
+};
+
+// Followed by one model matrix, then rangeCount index ranges of the object's level 0
+struct DrawInstanceRangesCommand
+{
+	Object* object;
+	uint32_t rangeCount;
+};
+
+// World space box drawn into a hardware occlusion query of the slot
+struct OcclusionQueryCommand
+{
+	int slot;
+	vec3 boundsMin;
+	vec3 boundsMax;
+};
+
+// Records rendering commands without touching the graphics API, so any thread can fill one
+// A backend replays the buffers on the thread owning the context, see GLCommandBackend
+// Commands are packed in one byte stream, recording a frame allocates nothing once the buffer has grown
+class CommandBuffer
+{
+public:
+	CommandBuffer()
+	{
+		commandCount = 0;
+	}
+
+	// Keeps the capacity
+	void Reset()
+	{
+		data.clear();
+		commandCount = 0;
+	}
+
+	void BindPipeline(Shader& shader, PipelineState state = PipelineState())
+	{
+		BindPipelineCommand command;
+		command.shader = &shader;
+		command.state = state;
+		Write(BIND_PIPELINE_COMMAND, &command, sizeof(command));
+	}
+
+	void BindTexture(unsigned int unit, unsigned int texture)
+	{
+		BindTextureCommand command;
+		command.unit = unit;
+		command.texture = texture;
+		Write(BIND_TEXTURE_COMMAND, &command, sizeof(command));
+	}
+
+	// Applies to the shader of the last BindPipeline
+	template <typename T>
+	void SetUniform(UniformHandle<T> uniform, const T& value)
+	{
+		SetUniformCommand command;
+		command.location = uniform.location;
+		command.type = UniformValue<T>::type;
+		memcpy(command.value, &value, sizeof(T));
+		Write(SET_UNIFORM_COMMAND, &command, sizeof(command));
+	}
+
+	void Draw(Object& object, int occlusionSlot = -1, int lod = 0)
+	{
+		DrawCommand command;
+		command.object = &object;
+		command.occlusionSlot = occlusionSlot;
+		command.lod = lod;
+		Write(DRAW_COMMAND, &command, sizeof(command));
+	}
+
+	// The model matrices are copied into the buffer
+	void DrawInstances(Object& object, const mat4* modelMatrices, int instanceCount, int lod = 0)
+	{
+		if (instanceCount == 0)
+		{
+			return;
+		}
+
+		DrawInstancesCommand command;
+		command.object = &object;
+		command.instanceCount = instanceCount;
+		command.lod = lod;
+		unsigned char* payload = Write(DRAW_INSTANCES_COMMAND, &command, sizeof(command), instanceCount * sizeof(mat4));
+		memcpy(payload + Align(sizeof(command)), modelMatrices, instanceCount * sizeof(mat4));
+	}
+
+	// Parts of the object's level 0, like its meshlets left after culling, the ranges are copied into the buffer
+	void DrawRanges(Object& object, const IndexRange* ranges, int rangeCount, int occlusionSlot = -1)
+	{
+		if (rangeCount == 0)
+		{
+			return;
+		}
+
+		DrawRangesCommand command;
+		command.object = &object;
+		command.occlusionSlot = occlusionSlot;
+		command.rangeCount = rangeCount;
+		unsigned char* payload = Write(DRAW_RANGES_COMMAND, &command, sizeof(command), rangeCount * sizeof(IndexRange));
+		memcpy(payload + Align(sizeof(command)), ranges, rangeCount * sizeof(IndexRange));
+	}
+
+	// DrawRanges for one instance, batched like DrawInstances
+	void DrawInstanceRanges(Object& object, const mat4& modelMatrix, const IndexRange* ranges, int rangeCount)
+	{
+		if (rangeCount == 0)
+		{
+			return;
+		}
+
+		DrawInstanceRangesCommand command;
+		command.object = &object;
+		command.rangeCount = rangeCount;
+		unsigned char* payload = Write(DRAW_INSTANCE_RANGES_COMMAND, &command, sizeof(command), sizeof(mat4) + rangeCount * sizeof(IndexRange));
+		memcpy(payload + Align(sizeof(command)), &modelMatrix, sizeof(mat4));
+		memcpy(payload + Align(sizeof(command)) + sizeof(mat4), ranges, rangeCount * sizeof(IndexRange));
+	}
+
+	// Tests the box against the depth drawn so far, the result gates the slot's draws of the next frame
+	void QueryOcclusion(int slot, const vec3& boundsMin, const vec3& boundsMax)
+	{
+		OcclusionQueryCommand command;
+		command.slot = slot;
+		command.boundsMin = boundsMin;
+		command.boundsMax = boundsMax;
+		Write(OCCLUSION_QUERY_COMMAND, &command, sizeof(command));
+	}
+
+	int GetCommandCount() const
+	{
+		return commandCount;
+	}
+
+	// Walks the stream, calling visitor(const CommandHeader&, const unsigned char* payload) for each command
+	template <typename Visitor>
+	void ForEach(Visitor visitor) const
+	{
+		size_t offset = 0;
+		while (offset < data.size())
+		{
+			const CommandHeader* header = (const CommandHeader*)&data[offset];
+			visitor(*header, &data[offset + sizeof(CommandHeader)]);
+			offset += header->size;
+		}
+	}
+
+	// Size of a payload struct, padded so the next part stays 8 byte aligned
+	static size_t Align(size_t size)
+	{
+		return (size + 7) & ~(size_t)7;
+	}
+
+private:
+	vector<unsigned char> data;
+	int commandCount;
+
+	// Returns the payload, extraSize bytes are reserved after the command struct
+	unsigned char* Write(CommandType type, const void* command, size_t size, size_t extraSize = 0)
+	{
+		CommandHeader header;
+		header.type = type;
+		header.size = (uint32_t)(sizeof(CommandHeader) + Align(size) + Align(extraSize));
+
+		size_t offset = data.size();
+		data.resize(offset + header.size);
+		memcpy(&data[offset], &header, sizeof(header));
+		memcpy(&data[offset + sizeof(header)], command, size);
+		commandCount++;
+		return &data[offset + sizeof(header)];
+	}
+};
+
+#endif
@@ -0,0 +1,253 @@
+#ifndef DRAW_BATCHER_H
+#define DRAW_BATCHER_H
+
+#include "GLCapabilities.h"
+#include "GLState.h"
+#include "InstanceBuffer.h"
+#include "MeshArena.h"
+#include "Object.h"
+
+#include <glad/glad.h>
+#include <glm/glm/glm.hpp>
+#include <vector>
+
+using namespace std;
+using namespace glm;
+
+// Layout read by glMultiDrawElementsIndirect from GL_DRAW_INDIRECT_BUFFER
+struct DrawElementsIndirectCommand
+{
+	unsigned int count;			// Indices per instance
+	unsigned int instanceCount;
+	unsigned int firstIndex;	// In indices, not bytes
+	int baseVertex;
+	unsigned int baseInstance;	// First model matrix of the draw in the instance buffer
+};
+
+// Collects the draws of a frame and submits every draw sharing an arena, index type and texture with one
+// glMultiDrawElementsIndirect call. Each draw's model matrices start at its baseInstance in the instance buffer,
+// which is how the vertex shader gets per-draw data
+// Contexts without GL 4.3 fall back to one instanced base vertex draw per command
+class DrawBatcher
+{
+public:
+	int submittedDraws;		// Commands in the last Submit
+	int submittedCalls;		// GL draw calls issued for them
+
+	DrawBatcher(InstanceBuffer& instanceBuffer) : instanceBuffer(instanceBuffer)
+	{
+		submittedDraws = 0;
+		submittedCalls = 0;
+		indirectCapacity = 0;
+
+		glGenBuffers(1, &indirectBuffer);
+	}
+
+	void Begin()
+	{
+		batches.clear();
+		instanceMatrices.clear();
+	}
+
+	// Queues instanceCount copies of object at the given level of detail, modelMatrices already include the object's position decode matrix
+	void Add(Object& object, const mat4* modelMatrices, int instanceCount, int lod = 0)
+	{
+		if (instanceCount == 0)
+		{
+			return;
+		}
+
+		const MeshAllocation& allocation = object.GetAllocation(lod);
+		Batch& batch = FindBatch(object.GetArena(), allocation.indexType, object.GetTexture());
+
+		// Sorted submissions add the same mesh many times in a row, those extend the previous command
+		unsigned int firstIndex = allocation.indexOffset / MeshBuilder::IndexSize(allocation.indexType);
+		if (!batch.commands.empty())
+		{
+			DrawElementsIndirectCommand& last = batch.commands.back();
+			if (last.firstIndex == firstIndex && last.count == (unsigned int)allocation.indexCount && last.baseVertex == allocation.baseVertex &&
+				last.baseInstance + last.instanceCount == instanceMatrices.size())
+			{
+				last.instanceCount += instanceCount;
+				instanceMatrices.insert(instanceMatrices.end(), modelMatrices, modelMatrices + instanceCount);
+				return;
+			}
+		}
+
+		DrawElementsIndirectCommand command;
+		command.count = allocation.indexCount;
+		command.instanceCount = instanceCount;
+		command.firstIndex = firstIndex;
+		command.baseVertex = allocation.baseVertex;
+		command.baseInstance = (unsigned int)instanceMatrices.size();
+		batch.commands.push_back(command);
+
+		instanceMatrices.insert(instanceMatrices.end(), modelMatrices, modelMatrices + instanceCount);
+	}
+
+	// Queues index ranges of object's level 0 drawn with one model matrix, every range becomes a command reading that matrix
+	void AddRanges(Object& object, const mat4& modelMatrix, const IndexRange* ranges, int rangeCount)
+	{
+		const MeshAllocation& allocation = object.GetAllocation();
+		Batch& batch = FindBatch(object.GetArena(), allocation.indexType, object.GetTexture());
+
+		unsigned int firstIndex = allocation.indexOffset / MeshBuilder::IndexSize(allocation.indexType);
+		for (int i = 0; i < rangeCount; i++)
+		{
+			DrawElementsIndirectCommand command;
+			command.count = ranges[i].indexCount;
+			command.instanceCount = 1;
+			command.firstIndex = firstIndex + ranges[i].firstIndex;
+			command.baseVertex = allocation.baseVertex;
+			command.baseInstance = (unsigned int)instanceMatrices.size();
+			batch.commands.push_back(command);
+		}
+
+		instanceMatrices.push_back(modelMatrix);
+	}
+
+	void Submit()
+	{
+		submittedDraws = 0;
+		submittedCalls = 0;
+		if (batches.empty())
+		{
+			return;
+		}
+
+		instanceBuffer.Upload(instanceMatrices.data(), (int)instanceMatrices.size());
+
+		if (GLCapabilities::MultiDrawIndirect())
+		{
+			SubmitIndirect();
+		}
+		else
+		{
+			SubmitLoop();
+		}
+	}
+
+private:
+	struct Batch
+	{
+		MeshArena* arena;
+		GLenum indexType;
+		unsigned int texture;
+		vector<DrawElementsIndirectCommand> commands;
+	};
+
+	InstanceBuffer& instanceBuffer;
+	vector<Batch> batches;
+	vector<mat4> instanceMatrices;
+
+	unsigned int indirectBuffer;
+	int indirectCapacity; // In commands
+
+	Batch& FindBatch(MeshArena& arena, GLenum indexType, unsigned int texture)
+	{
+		for (size_t i = 0; i < batches.size(); i++)
+		{
+			if (batches[i].arena == &arena && batches[i].indexType == indexType && batches[i].texture == texture)
+			{
+				return batches[i];
+			}
+		}
+
+		Batch batch;
+		batch.arena = &arena;
+		batch.indexType = indexType;
+		batch.texture = texture;
+		batches.push_back(batch);
+		return batches.back();
+	}
+
+	void BindBatch(Batch& batch)
+	{
+		if (batch.arena->GetInstanceBuffer() != &instanceBuffer)
+		{
+			batch.arena->SetInstanceBuffer(instanceBuffer);
+		}
+		batch.arena->Bind();
+
+		GLState::ActiveTexture(0);
+		GLState::BindTexture(GL_TEXTURE_2D, batch.texture);
+	}
+
+	void SubmitIndirect()
+	{
+#ifdef GL_VERSION_4_3
+		// Every batch's commands go into one indirect buffer, each batch reads its own range
+		int commandCount = 0;
+		for (size_t i = 0; i < batches.size(); i++)
+		{
+			commandCount += (int)batches[i].commands.size();
+		}
+
+		GLState::BindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+		if (commandCount > indirectCapacity)
+		{
+			indirectCapacity = commandCount > indirectCapacity * 2 ? commandCount : indirectCapacity * 2;
+		}
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, indirectCapacity * sizeof(DrawElementsIndirectCommand), NULL, GL_STREAM_DRAW);
+
+		int offset = 0;
+		for (size_t i = 0; i < batches.size(); i++)
+		{
+			Batch& batch = batches[i];
+			int size = (int)batch.commands.size();
+			glBufferSubData(GL_DRAW_INDIRECT_BUFFER, offset * sizeof(DrawElementsIndirectCommand), size * sizeof(DrawElementsIndirectCommand), batch.commands.data());
+
+			BindBatch(batch);
+			glMultiDrawElementsIndirect(GL_TRIANGLES, batch.indexType, (void*)(offset * sizeof(DrawElementsIndirectCommand)), size, 0);
+
+			offset += size;
+			submittedDraws += size;
+			submittedCalls++;
+		}
+
+		GLState::BindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+#endif
+	}
+
+	void SubmitLoop()
+	{
+		bool baseInstance = GLCapabilities::BaseInstance();
+
+		for (size_t i = 0; i < batches.size(); i++)
+		{
+			Batch& batch = batches[i];
+			BindBatch(batch);
+
+			int indexSize = MeshBuilder::IndexSize(batch.indexType);
+			for (size_t c = 0; c < batch.commands.size(); c++)
+			{
+				const DrawElementsIndirectCommand& command = batch.commands[c];
+				void* indices = (void*)(size_t)(command.firstIndex * indexSize);
+
+				if (baseInstance)
+				{
+#ifdef GL_VERSION_4_2
+					glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, command.count, batch.indexType, indices, command.instanceCount, command.baseVertex, command.baseInstance);
+#endif
+				}
+				else
+				{
+					// GL 3.3 has no base instance, the instance attribute is offset instead
+					batch.arena->SetInstanceBuffer(instanceBuffer, command.baseInstance);
+					glDrawElementsInstancedBaseVertex(GL_TRIANGLES, command.count, batch.indexType, indices, command.instanceCount, command.baseVertex);
+				}
+
+				submittedDraws++;
+				submittedCalls++;
+			}
+
+			// Leaves the attribute pointing at the start of the buffer again
+			if (!baseInstance)
+			{
+				batch.arena->SetInstanceBuffer(instanceBuffer);
+			}
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,459 @@
+#ifndef ENTITY_WORLD_H
+#define ENTITY_WORLD_H
+
+#include "Bounds.h"
+#include "JobSystem.h"
+
+#include <glm/glm/glm.hpp>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+using namespace std;
+using namespace glm;
+
+class Object;
+
+// Components
+// Plain data, copied around with memcpy when entities move between chunks
+
+// World placement, sceneNode is the SceneGraph node the matrix is copied from each frame (-1 for none)
+struct TransformComponent
+{
+	mat4 worldMatrix;
+	int sceneNode;
+};
+
+// gpuMesh is the object's GPUCuller mesh, resolved once when the entity is created, -1 when it is not GPU culled
+struct MeshRefComponent
+{
+	Object* object;
+	int gpuMesh;
+};
+
+// Local space, moved by the entity's world matrix when culling
+// proxy is the entity's primitive in a culling BVH, -1 when it is culled on its own
+struct BoundsComponent
+{
+	BoundingSphere sphere;
+	int proxy;
+};
+
+// What the entity is drawn with, GL names used for render queue keys
+struct MaterialComponent
+{
+	unsigned int shader;
+	unsigned int texture;
+};
+
+// Level of detail the entity is drawn with, see LodSelector
+// While fade is below 1 the entity cross-fades from previousLod to lod, both are drawn dithered
+struct LodComponent
+{
+	int lod;
+	int previousLod;
+	float fade;
+};
+
+enum ComponentType
+{
+	TRANSFORM_COMPONENT,
+	MESH_REF_COMPONENT,
+	BOUNDS_COMPONENT,
+	MATERIAL_COMPONENT,
+	LOD_COMPONENT,
+	COMPONENT_TYPE_COUNT
+};
+
+typedef unsigned int ComponentMask;
+
+template <typename T> struct ComponentTraits;
+template <> struct ComponentTraits<TransformComponent> { static const ComponentType type = TRANSFORM_COMPONENT; };
+template <> struct ComponentTraits<MeshRefComponent> { static const ComponentType type = MESH_REF_COMPONENT; };
+template <> struct ComponentTraits<BoundsComponent> { static const ComponentType type = BOUNDS_COMPONENT; };
+template <> struct ComponentTraits<MaterialComponent> { static const ComponentType type = MATERIAL_COMPONENT; };
+template <> struct ComponentTraits<LodComponent> { static const ComponentType type = LOD_COMPONENT; };
+
+// Stays valid until the entity is destroyed, a reused index gets a new generation
+struct Entity
+{
+	uint32_t index;
+	uint32_t generation;
+};
+
+// Entities grouped by archetype (their exact set of components)
+// Every archetype stores its entities in 16KB chunks, one array per component inside the chunk (SoA)
+// Queries walk the chunks of every matching archetype in order, so they only touch contiguous memory
+// Structural changes (create, destroy, add or remove a component) must not happen during a query
+class EntityWorld
+{
+public:
+	static const int CHUNK_SIZE = 16 * 1024;
+
+	EntityWorld()
+	{
+		for (int i = 0; i < (1 << COMPONENT_TYPE_COUNT); i++)
+		{
+			archetypeOfMask[i] = -1;
+		}
+	}
+
+	template <typename... Components>
+	Entity CreateEntity(const Components&... components)
+	{
+		uint32_t index;
+		if (!freeIndices.empty())
+		{
+			index = freeIndices.back();
+			freeIndices.pop_back();
+		}
+		else
+		{
+			index = (uint32_t)records.size();
+			records.push_back(EntityRecord());
+			records.back().generation = 0;
+		}
+
+		EntityRecord& record = records[index];
+		record.archetype = GetArchetype(MaskOf<Components...>());
+		AddRow(record.archetype, index, record.chunk, record.row);
+
+		Entity entity = { index, record.generation };
+		int expand[] = { 0, (Get<Components>(entity) = components, 0)... };
+		(void)expand;
+		return entity;
+	}
+
+	void DestroyEntity(Entity entity)
+	{
+		if (!IsAlive(entity))
+		{
+			return;
+		}
+
+		EntityRecord& record = records[entity.index];
+		RemoveRow(record.archetype, record.chunk, record.row);
+		record.archetype = -1;
+		record.generation++;
+		freeIndices.push_back(entity.index);
+	}
+
+	bool IsAlive(Entity entity) const
+	{
+		return entity.index < records.size() && records[entity.index].generation == entity.generation && records[entity.index].archetype != -1;
+	}
+
+	// False for destroyed or stale entities
+	template <typename T>
+	bool Has(Entity entity) const
+	{
+		if (!IsAlive(entity))
+		{
+			return false;
+		}
+		return (archetypes[records[entity.index].archetype].mask & MaskOf<T>()) != 0;
+	}
+
+	// The entity must be alive and have the component
+	template <typename T>
+	T& Get(Entity entity)
+	{
+		assert(Has<T>(entity));
+		const EntityRecord& record = records[entity.index];
+		Archetype& archetype = archetypes[record.archetype];
+		return GetArray<T>(archetype, *archetype.chunks[record.chunk])[record.row];
+	}
+
+	// Moves the entity to the archetype with the extra component, does nothing for destroyed or stale entities
+	template <typename T>
+	void AddComponent(Entity entity, const T& component)
+	{
+		if (!IsAlive(entity))
+		{
+			return;
+		}
+		if (!Has<T>(entity))
+		{
+			MoveEntity(entity.index, archetypes[records[entity.index].archetype].mask | MaskOf<T>());
+		}
+		Get<T>(entity) = component;
+	}
+
+	// Does nothing for destroyed or stale entities
+	template <typename T>
+	void RemoveComponent(Entity entity)
+	{
+		if (Has<T>(entity))
+		{
+			MoveEntity(entity.index, archetypes[records[entity.index].archetype].mask & ~MaskOf<T>());
+		}
+	}
+
+	// Calls function(count, Components*...) once per chunk holding every requested component
+	// The pointers are the chunk's component arrays, count entities long
+	template <typename... Components, typename Function>
+	void ForEachChunk(const Function& function)
+	{
+		ComponentMask mask = MaskOf<Components...>();
+		for (Archetype& archetype : archetypes)
+		{
+			if ((archetype.mask & mask) != mask)
+			{
+				continue;
+			}
+			for (unique_ptr<Chunk>& chunk : archetype.chunks)
+			{
+				function(chunk->count, GetArray<Components>(archetype, *chunk)...);
+			}
+		}
+	}
+
+	// Same as ForEachChunk, with chunks split across the job system
+	// function(chunkIndex, count, Components*...), chunkIndex numbers the matching chunks from 0 to CountChunks() - 1
+	// so every chunk can write to its own output slot
+	template <typename... Components, typename Function>
+	void ParallelForEachChunk(const Function& function, int chunksPerJob = 1)
+	{
+		ComponentMask mask = MaskOf<Components...>();
+		vector<ChunkReference> matches;
+		for (Archetype& archetype : archetypes)
+		{
+			if ((archetype.mask & mask) != mask)
+			{
+				continue;
+			}
+			for (unique_ptr<Chunk>& chunk : archetype.chunks)
+			{
+				ChunkReference reference = { &archetype, chunk.get() };
+				matches.push_back(reference);
+			}
+		}
+
+		JobSystem::ParallelFor((int)matches.size(), chunksPerJob, [&matches, &function](int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				function(i, matches[i].chunk->count, GetArray<Components>(*matches[i].archetype, *matches[i].chunk)...);
+			}
+		});
+	}
+
+	template <typename... Components>
+	int CountChunks() const
+	{
+		ComponentMask mask = MaskOf<Components...>();
+		int count = 0;
+		for (const Archetype& archetype : archetypes)
+		{
+			if ((archetype.mask & mask) == mask)
+			{
+				count += (int)archetype.chunks.size();
+			}
+		}
+		return count;
+	}
+
+	int GetEntityCount() const
+	{
+		return (int)(records.size() - freeIndices.size());
+	}
+
+	// Entities that fit in one chunk of the archetype with these components
+	template <typename... Components>
+	int GetChunkCapacity()
+	{
+		return archetypes[GetArchetype(MaskOf<Components...>())].capacity;
+	}
+
+private:
+	struct Chunk
+	{
+		unsigned char data[CHUNK_SIZE];
+		int count;
+	};
+
+	struct Archetype
+	{
+		ComponentMask mask;
+		int capacity;
+		int offsets[COMPONENT_TYPE_COUNT]; // Byte offset of each component array in a chunk, -1 when absent
+		int entityOffset;				   // Array of entity indices, to fix records when rows move
+		vector<unique_ptr<Chunk>> chunks;  // Every chunk but the last is full
+	};
+
+	struct EntityRecord
+	{
+		int archetype;
+		int chunk;
+		int row;
+		uint32_t generation;
+	};
+
+	struct ChunkReference
+	{
+		Archetype* archetype;
+		Chunk* chunk;
+	};
+
+	vector<Archetype> archetypes;
+	int archetypeOfMask[1 << COMPONENT_TYPE_COUNT];
+	vector<EntityRecord> records;
+	vector<uint32_t> freeIndices;
+
+	template <typename... Components>
+	static ComponentMask MaskOf()
+	{
+		ComponentMask mask = 0;
+		int expand[] = { 0, (mask |= 1u << ComponentTraits<Components>::type, 0)... };
+		(void)expand;
+		return mask;
+	}
+
+	static int ComponentSize(int type)
+	{
+		static const int sizes[COMPONENT_TYPE_COUNT] =
+		{
+			sizeof(TransformComponent),
+			sizeof(MeshRefComponent),
+			sizeof(BoundsComponent),
+			sizeof(MaterialComponent),
+			sizeof(LodComponent)
+		};
+		return sizes[type];
+	}
+
+	template <typename T>
+	static T* GetArray(Archetype& archetype, Chunk& chunk)
+	{
+		return (T*)(chunk.data + archetype.offsets[ComponentTraits<T>::type]);
+	}
+
+	static uint32_t* GetEntities(Archetype& archetype, Chunk& chunk)
+	{
+		return (uint32_t*)(chunk.data + archetype.entityOffset);
+	}
+
+	int GetArchetype(ComponentMask mask)
+	{
+		if (archetypeOfMask[mask] != -1)
+		{
+			return archetypeOfMask[mask];
+		}
+
+		Archetype archetype;
+		archetype.mask = mask;
+
+		int bytesPerEntity = sizeof(uint32_t);
+		for (int type = 0; type < COMPONENT_TYPE_COUNT; type++)
+		{
+			bytesPerEntity += (mask & (1u << type)) ? ComponentSize(type) : 0;
+		}
+
+		// Arrays start 16 byte aligned, the padding may cost a few entities
+		for (archetype.capacity = CHUNK_SIZE / bytesPerEntity; ; archetype.capacity--)
+		{
+			int offset = 0;
+			for (int type = 0; type < COMPONENT_TYPE_COUNT; type++)
+			{
+				archetype.offsets[type] = -1;
+				if (mask & (1u << type))
+				{
+					archetype.offsets[type] = offset;
+					offset = (offset + ComponentSize(type) * archetype.capacity + 15) & ~15;
+				}
+			}
+			archetype.entityOffset = offset;
+			if (offset + (int)sizeof(uint32_t) * archetype.capacity <= CHUNK_SIZE)
+			{
+				break;
+			}
+		}
+
+		archetypes.push_back(move(archetype));
+		archetypeOfMask[mask] = (int)archetypes.size() - 1;
+		return archetypeOfMask[mask];
+	}
+
+	// Appends a zeroed row to the archetype's last chunk
+	void AddRow(int archetypeIndex, uint32_t entityIndex, int& chunkIndex, int& row)
+	{
+		Archetype& archetype = archetypes[archetypeIndex];
+		if (archetype.chunks.empty() || archetype.chunks.back()->count == archetype.capacity)
+		{
+			archetype.chunks.push_back(unique_ptr<Chunk>(new Chunk));
+			archetype.chunks.back()->count = 0;
+		}
+
+		Chunk& chunk = *archetype.chunks.back();
+		chunkIndex = (int)archetype.chunks.size() - 1;
+		row = chunk.count++;
+
+		for (int type = 0; type < COMPONENT_TYPE_COUNT; type++)
+		{
+			if (archetype.offsets[type] != -1)
+			{
+				memset(chunk.data + archetype.offsets[type] + ComponentSize(type) * row, 0, ComponentSize(type));
+			}
+		}
+		GetEntities(archetype, chunk)[row] = entityIndex;
+	}
+
+	// Fills the hole with the archetype's last row, so chunks stay dense
+	void RemoveRow(int archetypeIndex, int chunkIndex, int row)
+	{
+		Archetype& archetype = archetypes[archetypeIndex];
+		Chunk& chunk = *archetype.chunks[chunkIndex];
+		Chunk& last = *archetype.chunks.back();
+		int lastRow = last.count - 1;
+
+		if (&chunk != &last || row != lastRow)
+		{
+			CopyRow(archetype, last, lastRow, archetype, chunk, row);
+			uint32_t moved = GetEntities(archetype, last)[lastRow];
+			GetEntities(archetype, chunk)[row] = moved;
+			records[moved].chunk = chunkIndex;
+			records[moved].row = row;
+		}
+
+		if (--last.count == 0)
+		{
+			archetype.chunks.pop_back();
+		}
+	}
+
+	// Components the two archetypes share are copied, the others are left zeroed
+	void CopyRow(Archetype& source, Chunk& sourceChunk, int sourceRow, Archetype& destination, Chunk& destinationChunk, int destinationRow)
+	{
+		for (int type = 0; type < COMPONENT_TYPE_COUNT; type++)
+		{
+			if (source.offsets[type] != -1 && destination.offsets[type] != -1)
+			{
+				int size = ComponentSize(type);
+				memcpy(destinationChunk.data + destination.offsets[type] + size * destinationRow,
+					   sourceChunk.data + source.offsets[type] + size * sourceRow, size);
+			}
+		}
+	}
+
+	void MoveEntity(uint32_t entityIndex, ComponentMask mask)
+	{
+		EntityRecord& record = records[entityIndex];
+		int destinationIndex = GetArchetype(mask); // May grow archetypes, references are taken after
+
+		int chunkIndex, row;
+		AddRow(destinationIndex, entityIndex, chunkIndex, row);
+
+		Archetype& source = archetypes[record.archetype];
+		Archetype& destination = archetypes[destinationIndex];
+		CopyRow(source, *source.chunks[record.chunk], record.row, destination, *destination.chunks[chunkIndex], row);
+		RemoveRow(record.archetype, record.chunk, record.row);
+
+		record.archetype = destinationIndex;
+		record.chunk = chunkIndex;
+		record.row = row;
+	}
+};
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef FRAME_PIPELINE_H
+#define FRAME_PIPELINE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+using namespace std;
+
+// Lock-free hand-off of the latest T from one writer thread to one reader thread
+// The writer fills the back slot and publishes it, the reader acquires the newest published slot
+// Neither side ever waits, a slot published twice before the reader acquires it replaces the older one
+template <typename T>
+class TripleBuffer
+{
+public:
+	TripleBuffer() : back(0), middle(1), front(2)
+	{
+	}
+
+	// Writer only
+	T& GetWriteSlot()
+	{
+		return slots[back];
+	}
+
+	// Writer only, the write slot becomes readable and the writer gets a free slot
+	void Publish()
+	{
+		back = middle.exchange(back | NEW_FLAG, memory_order_acq_rel) & INDEX_MASK;
+	}
+
+	// Reader only, false when nothing was published since the last Acquire
+	bool Acquire()
+	{
+		if (!(middle.load(memory_order_relaxed) & NEW_FLAG))
+		{
+			return false;
+		}
+		front = middle.exchange(front, memory_order_acq_rel) & INDEX_MASK;
+		return true;
+	}
+
+	// Reader only, the slot of the last Acquire
+	T& GetReadSlot()
+	{
+		return slots[front];
+	}
+
+private:
+	static const int INDEX_MASK = 3;
+	static const int NEW_FLAG = 4; // Set in middle while it holds a slot the reader has not seen
+
+	T slots[3];
+	int back;
+	atomic<int> middle;
+	int front;
+};
+
+// Keeps the simulation thread at most frameLatency frames ahead of the render thread
+// With a latency of 1 the simulation builds frame N + 1 while frame N renders
+// With 2 it may also finish frame N + 1 and start N + 2, for throughput when one side is irregular
+class FramePacer
+{
+public:
+	FramePacer(int frameLatency)
+	{
+		this->frameLatency = frameLatency < 1 ? 1 : (frameLatency > 2 ? 2 : frameLatency);
+		acquiredFrame = -1;
+		stopped = false;
+	}
+
+	// Simulation thread, false once stopped
+	bool WaitToSimulate(long long frame)
+	{
+		unique_lock<mutex> lock(frameMutex);
+		frameCondition.wait(lock, [this, frame]() { return stopped || frame <= acquiredFrame + frameLatency; });
+		return !stopped;
+	}
+
+	// Simulation thread, the previous frame has to be acquired first or publishing would replace it
+	bool WaitToPublish(long long frame)
+	{
+		unique_lock<mutex> lock(frameMutex);
+		frameCondition.wait(lock, [this, frame]() { return stopped || frame - 1 <= acquiredFrame; });
+		return !stopped;
+	}
+
+	// Render thread, after acquiring a frame
+	void FrameAcquired(long long frame)
+	{
+		{
+			lock_guard<mutex> lock(frameMutex);
+			acquiredFrame = frame;
+		}
+		frameCondition.notify_all();
+	}
+
+	void Stop()
+	{
+		{
+			lock_guard<mutex> lock(frameMutex);
+			stopped = true;
+		}
+		frameCondition.notify_all();
+	}
+
+	int GetFrameLatency()
+	{
+		return frameLatency;
+	}
+
+private:
+	int frameLatency;
+	long long acquiredFrame;
+	bool stopped;
+
+	mutex frameMutex;
+	condition_variable frameCondition;
+};
+
+#endif
@@ -0,0 +1,158 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include "Bounds.h"
+#include "Simd.h"
+
+#include <glm/glm/glm.hpp>
+#include <vector>
+
+using namespace std;
+using namespace glm;
+
+// Six planes stored as (normal, distance), normals pointing into the frustum
+struct Frustum
+{
+	vec4 planes[6];
+
+	// Extracts the planes from a Projection * View matrix (Gribb/Hartmann)
+	static Frustum FromMatrix(const mat4& viewProjection)
+	{
+		// glm is column major, rows are gathered across columns
+		vec4 rows[4];
+		for (int i = 0; i < 4; i++)
+		{
+			rows[i] = vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+		}
+
+		Frustum frustum;
+		frustum.planes[0] = rows[3] + rows[0]; // Left
+		frustum.planes[1] = rows[3] - rows[0]; // Right
+		frustum.planes[2] = rows[3] + rows[1]; // Bottom
+		frustum.planes[3] = rows[3] - rows[1]; // Top
+		frustum.planes[4] = rows[3] + rows[2]; // Near
+		frustum.planes[5] = rows[3] - rows[2]; // Far
+
+		// Normalized so plane distances are in world units and can be compared to radii
+		for (int i = 0; i < 6; i++)
+		{
+			frustum.planes[i] = frustum.planes[i] / length(vec3(frustum.planes[i]));
+		}
+
+		return frustum;
+	}
+
+	bool IsVisible(const vec3& center, float radius) const
+	{
+		for (int i = 0; i < 6; i++)
+		{
+			if (dot(vec3(planes[i]), center) + planes[i].w < -radius)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+};
+
+// Tests bounding spheres against a frustum, four at a time
+// Spheres are kept in separate arrays (SoA) so each SSE load fills a register with one component of four spheres
+class FrustumCuller
+{
+public:
+	int visibleCount;
+	int culledCount;
+
+	FrustumCuller()
+	{
+		visibleCount = 0;
+		culledCount = 0;
+	}
+
+	void Clear()
+	{
+		centerX.clear();
+		centerY.clear();
+		centerZ.clear();
+		radius.clear();
+	}
+
+	void AddSphere(const vec3& center, float radius)
+	{
+		centerX.push_back(center.x);
+		centerY.push_back(center.y);
+		centerZ.push_back(center.z);
+		this->radius.push_back(radius);
+	}
+
+	int GetSphereCount()
+	{
+		return (int)radius.size();
+	}
+
+	// Writes the indices of every sphere touching the frustum, in order
+	void Cull(const Frustum& frustum, vector<int>& visibleIndices)
+	{
+		visibleIndices.clear();
+
+		int count = GetSphereCount();
+		int i = 0;
+
+#ifdef USE_SSE
+		__m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+		for (int p = 0; p < 6; p++)
+		{
+			planeX[p] = _mm_set1_ps(frustum.planes[p].x);
+			planeY[p] = _mm_set1_ps(frustum.planes[p].y);
+			planeZ[p] = _mm_set1_ps(frustum.planes[p].z);
+			planeW[p] = _mm_set1_ps(frustum.planes[p].w);
+		}
+
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128 x = _mm_loadu_ps(&centerX[i]);
+			__m128 y = _mm_loadu_ps(&centerY[i]);
+			__m128 z = _mm_loadu_ps(&centerZ[i]);
+			__m128 negativeRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&radius[i]));
+
+			// A sphere is visible while it is not fully behind any plane
+			__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			for (int p = 0; p < 6; p++)
+			{
+				__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX[p], x), _mm_mul_ps(planeY[p], y)),
+											 _mm_add_ps(_mm_mul_ps(planeZ[p], z), planeW[p]));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negativeRadius));
+			}
+
+			int mask = _mm_movemask_ps(inside);
+			for (int lane = 0; lane < 4; lane++)
+			{
+				if (mask & (1 << lane))
+				{
+					visibleIndices.push_back(i + lane);
+				}
+			}
+		}
+#endif
+
+		// Remaining spheres (or all of them without SSE)
+		for (; i < count; i++)
+		{
+			if (frustum.IsVisible(vec3(centerX[i], centerY[i], centerZ[i]), radius[i]))
+			{
+				visibleIndices.push_back(i);
+			}
+		}
+
+		visibleCount = (int)visibleIndices.size();
+		culledCount = count - visibleCount;
+	}
+
+private:
+	vector<float> centerX;
+	vector<float> centerY;
+	vector<float> centerZ;
+	vector<float> radius;
+};
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef GL_CAPABILITIES_H
+#define GL_CAPABILITIES_H
+
+#include <glad/glad.h>
+
+// Optional features of the current context, valid once GLAD is loaded
+// Also guarded at compile time, so a GLAD generated for GL 3.3 still builds without them
+class GLCapabilities
+{
+public:
+	// glDrawElementsInstancedBaseVertexBaseInstance
+	static bool BaseInstance()
+	{
+#ifdef GL_VERSION_4_2
+		return GLAD_GL_VERSION_4_2 != 0;
+#else
+		return false;
+#endif
+	}
+
+	// glMultiDrawElementsIndirect
+	static bool MultiDrawIndirect()
+	{
+#ifdef GL_VERSION_4_3
+		return GLAD_GL_VERSION_4_3 != 0;
+#else
+		return false;
+#endif
+	}
+
+	// Compute shaders, shader storage buffers and image load/store
+	static bool ComputeShader()
+	{
+#ifdef GL_VERSION_4_3
+		return GLAD_GL_VERSION_4_3 != 0;
+#else
+		return false;
+#endif
+	}
+};
+
+#endif
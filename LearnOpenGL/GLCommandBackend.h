@@ -0,0 +1,185 @@
+#ifndef GL_COMMAND_BACKEND_H
+#define GL_COMMAND_BACKEND_H
+
+#include "CommandBuffer.h"
+#include "DrawBatcher.h"
+#include "GLState.h"
+#include "HardwareOcclusion.h"
+#include "Object.h"
+#include "Shader.h"
+
+#include <glad/glad.h>
+#include <glm/glm/glm.hpp>
+
+using namespace std;
+using namespace glm;
+
+// Replays command buffers with GL, must run on the thread owning the context
+// Instanced draws go through the draw batcher and are submitted together until a state change or End()
+// Occlusion commands need a HardwareOcclusion, without one draws are unconditional and queries are skipped
+class GLCommandBackend
+{
+public:
+	GLCommandBackend(DrawBatcher& batcher, HardwareOcclusion* occlusion = NULL) : batcher(batcher)
+	{
+		this->occlusion = occlusion;
+		shader = NULL;
+		batchedDraws = 0;
+	}
+
+	void Begin()
+	{
+		shader = NULL;
+		batcher.Begin();
+		batchedDraws = 0;
+	}
+
+	// Buffers execute in the order they are given
+	void Execute(const CommandBuffer& commands)
+	{
+		commands.ForEach([this](const CommandHeader& header, const unsigned char* payload)
+		{
+			switch (header.type)
+			{
+			case BIND_PIPELINE_COMMAND:
+				BindPipeline(*(const BindPipelineCommand*)payload);
+				break;
+			case BIND_TEXTURE_COMMAND:
+				BindTexture(*(const BindTextureCommand*)payload);
+				break;
+			case SET_UNIFORM_COMMAND:
+				SetUniform(*(const SetUniformCommand*)payload);
+				break;
+			case DRAW_COMMAND:
+			{
+				Flush();
+				const DrawCommand* command = (const DrawCommand*)payload;
+				command->object->Draw(occlusion != NULL && command->occlusionSlot != -1 ? occlusion->GetConditionQuery(command->occlusionSlot) : 0, command->lod);
+				break;
+			}
+			case DRAW_INSTANCES_COMMAND:
+			{
+				const DrawInstancesCommand* command = (const DrawInstancesCommand*)payload;
+				const mat4* modelMatrices = (const mat4*)(payload + CommandBuffer::Align(sizeof(DrawInstancesCommand)));
+				batcher.Add(*command->object, modelMatrices, command->instanceCount, command->lod);
+				batchedDraws++;
+				break;
+			}
+			case DRAW_RANGES_COMMAND:
+			{
+				Flush();
+				const DrawRangesCommand* command = (const DrawRangesCommand*)payload;
+				const IndexRange* ranges = (const IndexRange*)(payload + CommandBuffer::Align(sizeof(DrawRangesCommand)));
+				command->object->DrawRanges(ranges, command->rangeCount, occlusion != NULL && command->occlusionSlot != -1 ? occlusion->GetConditionQuery(command->occlusionSlot) : 0);
+				break;
+			}
+			case DRAW_INSTANCE_RANGES_COMMAND:
+			{
+				const DrawInstanceRangesCommand* command = (const DrawInstanceRangesCommand*)payload;
+				const mat4* modelMatrix = (const mat4*)(payload + CommandBuffer::Align(sizeof(DrawInstanceRangesCommand)));
+				batcher.AddRanges(*command->object, *modelMatrix, (const IndexRange*)(modelMatrix + 1), command->rangeCount);
+				batchedDraws++;
+				break;
+			}
+			case OCCLUSION_QUERY_COMMAND:
+				QueryOcclusion(*(const OcclusionQueryCommand*)payload);
+				break;
+			}
+		});
+	}
+
+	void End()
+	{
+		Flush();
+		if (occlusion != NULL)
+		{
+			occlusion->EndQueries();
+		}
+	}
+
+private:
+	DrawBatcher& batcher;
+	HardwareOcclusion* occlusion;
+	Shader* shader;
+	int batchedDraws;
+
+	// Submits the instanced draws recorded before a state change
+	void Flush()
+	{
+		if (batchedDraws == 0)
+		{
+			return;
+		}
+		batcher.Submit();
+		batcher.Begin();
+		batchedDraws = 0;
+	}
+
+	void BindPipeline(const BindPipelineCommand& command)
+	{
+		Flush();
+		if (occlusion != NULL)
+		{
+			occlusion->EndQueries();
+		}
+		shader = command.shader;
+		shader->use();
+
+		GLState::SetEnabled(GL_DEPTH_TEST, command.state.depthTest);
+		GLState::SetDepthMask(command.state.depthWrite);
+		GLState::SetEnabled(GL_BLEND, command.state.blend);
+		if (command.state.blend)
+		{
+			GLState::SetBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		}
+		GLState::SetEnabled(GL_CULL_FACE, command.state.cullFace);
+	}
+
+	// Switches to the box program, a pipeline has to be bound again before uniforms are set
+	void QueryOcclusion(const OcclusionQueryCommand& command)
+	{
+		if (occlusion == NULL)
+		{
+			return;
+		}
+		Flush();
+		occlusion->Query(command.slot, command.boundsMin, command.boundsMax);
+		shader = NULL;
+	}
+
+	void BindTexture(const BindTextureCommand& command)
+	{
+		Flush();
+		GLState::ActiveTexture(command.unit);
+		GLState::BindTexture(GL_TEXTURE_2D, command.texture);
+	}
+
+	void SetUniform(const SetUniformCommand& command)
+	{
+		Flush();
+		const float* value = (const float*)command.value;
+		switch (command.type)
+		{
+		case BOOL_UNIFORM:
+			shader->set(UniformHandle<bool>(command.location), *(const bool*)command.value);
+			break;
+		case INT_UNIFORM:
+			shader->set(UniformHandle<int>(command.location), *(const int*)command.value);
+			break;
+		case FLOAT_UNIFORM:
+			shader->set(UniformHandle<float>(command.location), *value);
+			break;
+		case VEC3_UNIFORM:
+			shader->set(UniformHandle<vec3>(command.location), *(const vec3*)value);
+			break;
+		case VEC4_UNIFORM:
+			shader->set(UniformHandle<vec4>(command.location), *(const vec4*)value);
+			break;
+		case MAT4_UNIFORM:
+			shader->set(UniformHandle<mat4>(command.location), *(const mat4*)value);
+			break;
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,344 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <glad/glad.h>
+
+// Shadows the GL state the renderer changes and skips calls that would set it to what it already is
+// Every program, VAO, buffer, texture, depth/blend and viewport change should go through here, or the shadow goes stale
+// (call Invalidate after code that touches GL directly)
+class GLState
+{
+public:
+	static void UseProgram(unsigned int program)
+	{
+		State& state = Get();
+		if (state.program == program)
+		{
+			state.skippedCalls++;
+			return;
+		}
+		glUseProgram(program);
+		state.program = program;
+		state.issuedCalls++;
+	}
+
+	static unsigned int GetProgram()
+	{
+		return Get().program;
+	}
+
+	static void BindVertexArray(unsigned int vertexArray)
+	{
+		State& state = Get();
+		if (state.vertexArray == vertexArray)
+		{
+			state.skippedCalls++;
+			return;
+		}
+		glBindVertexArray(vertexArray);
+		state.vertexArray = vertexArray;
+		state.issuedCalls++;
+
+		// The element buffer binding belongs to the VAO, it changed along with it
+		state.buffers[ELEMENT_ARRAY_SLOT] = UNKNOWN;
+	}
+
+	static unsigned int GetVertexArray()
+	{
+		return Get().vertexArray;
+	}
+
+	static void BindBuffer(GLenum target, unsigned int buffer)
+	{
+		State& state = Get();
+		int slot = BufferSlot(target);
+		if (slot != -1 && state.buffers[slot] == buffer)
+		{
+			state.skippedCalls++;
+			return;
+		}
+		glBindBuffer(target, buffer);
+		if (slot != -1)
+		{
+			state.buffers[slot] = buffer;
+		}
+		state.issuedCalls++;
+	}
+
+	// Deleting a bound buffer unbinds it, the shadow has to forget it before the name gets reused
+	static void DeleteBuffer(unsigned int buffer)
+	{
+		State& state = Get();
+		for (int slot = 0; slot < BUFFER_SLOT_COUNT; slot++)
+		{
+			if (state.buffers[slot] == buffer)
+			{
+				state.buffers[slot] = slot == ELEMENT_ARRAY_SLOT ? UNKNOWN : 0;
+			}
+		}
+		glDeleteBuffers(1, &buffer);
+	}
+
+	// unit is the texture unit index, not GL_TEXTURE0 + index
+	static void ActiveTexture(unsigned int unit)
+	{
+		State& state = Get();
+		if (state.activeTexture == unit)
+		{
+			state.skippedCalls++;
+			return;
+		}
+		glActiveTexture(GL_TEXTURE0 + unit);
+		state.activeTexture = unit;
+		state.issuedCalls++;
+	}
+
+	// Binds to the active unit, only GL_TEXTURE_2D bindings are shadowed
+	static void BindTexture(GLenum target, unsigned int texture)
+	{
+		State& state = Get();
+		bool shadowed = target == GL_TEXTURE_2D && state.activeTexture < TEXTURE_UNIT_COUNT;
+		if (shadowed && state.textures[state.activeTexture] == texture)
+		{
+			state.skippedCalls++;
+			return;
+		}
+		glBindTexture(target, texture);
+		if (shadowed)
+		{
+			state.textures[state.activeTexture] = texture;
+		}
+		state.issuedCalls++;
+	}
+
+	// Only GL_DEPTH_TEST, GL_BLEND, GL_CULL_FACE and GL_SCISSOR_TEST are shadowed
+	static void SetEnabled(GLenum capability, bool enabled)
+	{
+		State& state = Get();
+		int slot = CapabilitySlot(capability);
+		if (slot != -1 && state.capabilities[slot] == (enabled ? 1 : 0))
+		{
+			state.skippedCalls++;
+			return;
+		}
+		if (enabled)
+		{
+			glEnable(capability);
+		}
+		else
+		{
+			glDisable(capability);
+		}
+		if (slot != -1)
+		{
+			state.capabilities[slot] = enabled ? 1 : 0;
+		}
+		state.issuedCalls++;
+	}
+
+	static void SetDepthFunc(GLenum function)
+	{
+		State& state = Get();
+		if (state.depthFunc == function)
+		{
+			state.skippedCalls++;
+			return;
+		}
+		glDepthFunc(function);
+		state.depthFunc = function;
+		state.issuedCalls++;
+	}
+
+	static void SetDepthMask(bool write)
+	{
+		State& state = Get();
+		if (state.depthMask == (write ? 1 : 0))
+		{
+			state.skippedCalls++;
+			return;
+		}
+		glDepthMask(write ? GL_TRUE : GL_FALSE);
+		state.depthMask = write ? 1 : 0;
+		state.issuedCalls++;
+	}
+
+	// All four channels together
+	static void SetColorMask(bool write)
+	{
+		State& state = Get();
+		if (state.colorMask == (write ? 1 : 0))
+		{
+			state.skippedCalls++;
+			return;
+		}
+		glColorMask(write ? GL_TRUE : GL_FALSE, write ? GL_TRUE : GL_FALSE, write ? GL_TRUE : GL_FALSE, write ? GL_TRUE : GL_FALSE);
+		state.colorMask = write ? 1 : 0;
+		state.issuedCalls++;
+	}
+
+	static void SetBlendFunc(GLenum source, GLenum destination)
+	{
+		State& state = Get();
+		if (state.blendSource == source && state.blendDestination == destination)
+		{
+			state.skippedCalls++;
+			return;
+		}
+		glBlendFunc(source, destination);
+		state.blendSource = source;
+		state.blendDestination = destination;
+		state.issuedCalls++;
+	}
+
+	static void SetViewport(int x, int y, int width, int height)
+	{
+		State& state = Get();
+		if (state.viewport[0] == x && state.viewport[1] == y && state.viewport[2] == width && state.viewport[3] == height)
+		{
+			state.skippedCalls++;
+			return;
+		}
+		glViewport(x, y, width, height);
+		state.viewport[0] = x;
+		state.viewport[1] = y;
+		state.viewport[2] = width;
+		state.viewport[3] = height;
+		state.issuedCalls++;
+	}
+
+	// Forgets everything, the next call of each kind is always issued
+	static void Invalidate()
+	{
+		State& state = Get();
+		int issuedCalls = state.issuedCalls;
+		int skippedCalls = state.skippedCalls;
+		state = State();
+		state.issuedCalls = issuedCalls;
+		state.skippedCalls = skippedCalls;
+	}
+
+	// State calls that reached GL, and the redundant ones that were dropped
+	static int GetIssuedCalls()
+	{
+		return Get().issuedCalls;
+	}
+
+	static int GetSkippedCalls()
+	{
+		return Get().skippedCalls;
+	}
+
+	static void ResetCounters()
+	{
+		Get().issuedCalls = 0;
+		Get().skippedCalls = 0;
+	}
+
+private:
+	static const unsigned int UNKNOWN = 0xFFFFFFFF;
+	static const int TEXTURE_UNIT_COUNT = 16;
+
+	enum BufferSlots
+	{
+		ARRAY_SLOT,
+		ELEMENT_ARRAY_SLOT,
+		COPY_READ_SLOT,
+		COPY_WRITE_SLOT,
+		UNIFORM_SLOT,
+		DRAW_INDIRECT_SLOT,
+		BUFFER_SLOT_COUNT
+	};
+
+	enum CapabilitySlots
+	{
+		DEPTH_TEST_SLOT,
+		BLEND_SLOT,
+		CULL_FACE_SLOT,
+		SCISSOR_TEST_SLOT,
+		CAPABILITY_SLOT_COUNT
+	};
+
+	// Values start unknown so the first call of each kind goes through
+	struct State
+	{
+		unsigned int program;
+		unsigned int vertexArray;
+		unsigned int buffers[BUFFER_SLOT_COUNT];
+		unsigned int activeTexture;
+		unsigned int textures[TEXTURE_UNIT_COUNT];
+		int capabilities[CAPABILITY_SLOT_COUNT];	// 0, 1 or -1 when unknown
+		GLenum depthFunc;
+		int depthMask;
+		int colorMask;
+		GLenum blendSource;
+		GLenum blendDestination;
+		int viewport[4];
+
+		int issuedCalls;
+		int skippedCalls;
+
+		State()
+		{
+			program = UNKNOWN;
+			vertexArray = UNKNOWN;
+			for (int i = 0; i < BUFFER_SLOT_COUNT; i++)
+			{
+				buffers[i] = UNKNOWN;
+			}
+			activeTexture = UNKNOWN;
+			for (int i = 0; i < TEXTURE_UNIT_COUNT; i++)
+			{
+				textures[i] = UNKNOWN;
+			}
+			for (int i = 0; i < CAPABILITY_SLOT_COUNT; i++)
+			{
+				capabilities[i] = -1;
+			}
+			depthFunc = UNKNOWN;
+			depthMask = -1;
+			colorMask = -1;
+			blendSource = UNKNOWN;
+			blendDestination = UNKNOWN;
+			viewport[0] = viewport[1] = viewport[2] = viewport[3] = -1;
+
+			issuedCalls = 0;
+			skippedCalls = 0;
+		}
+	};
+
+	static State& Get()
+	{
+		static State state;
+		return state;
+	}
+
+	static int BufferSlot(GLenum target)
+	{
+		switch (target)
+		{
+		case GL_ARRAY_BUFFER:			return ARRAY_SLOT;
+		case GL_ELEMENT_ARRAY_BUFFER:	return ELEMENT_ARRAY_SLOT;
+		case GL_COPY_READ_BUFFER:		return COPY_READ_SLOT;
+		case GL_COPY_WRITE_BUFFER:		return COPY_WRITE_SLOT;
+		case GL_UNIFORM_BUFFER:			return UNIFORM_SLOT;
+#ifdef GL_DRAW_INDIRECT_BUFFER
+		case GL_DRAW_INDIRECT_BUFFER:	return DRAW_INDIRECT_SLOT;
+#endif
+		default:						return -1;
+		}
+	}
+
+	static int CapabilitySlot(GLenum capability)
+	{
+		switch (capability)
+		{
+		case GL_DEPTH_TEST:		return DEPTH_TEST_SLOT;
+		case GL_BLEND:			return BLEND_SLOT;
+		case GL_CULL_FACE:		return CULL_FACE_SLOT;
+		case GL_SCISSOR_TEST:	return SCISSOR_TEST_SLOT;
+		default:				return -1;
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,359 @@
+#ifndef GPU_CULLER_H
+#define GPU_CULLER_H
+
+#include "DrawBatcher.h"
+#include "Frustum.h"
+#include "GLCapabilities.h"
+#include "GLState.h"
+#include "InstanceBuffer.h"
+#include "Object.h"
+#include "Shader.h"
+
+#include <glad/glad.h>
+#include <glm/glm/glm.hpp>
+#include <cassert>
+#include <vector>
+
+using namespace std;
+using namespace glm;
+
+// Mirrors the std430 Instance struct of gpuCull.cs
+struct GPUInstance
+{
+	mat4 worldMatrix;
+	unsigned int mesh; // Index returned by GPUCuller::AddMesh
+	unsigned int padding[3];
+};
+
+// New world matrix for GPUCuller::UpdateInstances, instance indexes the array given to SetInstances
+struct GPUInstanceUpdate
+{
+	int instance;
+	mat4 worldMatrix;
+};
+
+// GPU-driven culling, needs a GL 4.3 context (GLCapabilities::ComputeShader)
+// At the end of a frame the depth buffer is copied and reduced into a hierarchical Z pyramid, each texel holding
+// the farthest depth below it. The next frame a compute pass tests every instance's bounds against the frustum
+// and that pyramid, then appends the survivors' matrices and instance counts to indirect draw commands with atomics
+// The CPU uploads the instances once and afterwards only the transforms that changed, it never looks at visibility
+class GPUCuller
+{
+public:
+	static const int CULL_GROUP_SIZE = 64;	// local_size_x of gpuCull.cs
+	static const int HI_Z_GROUP_SIZE = 8;	// local_size_x and local_size_y of hiZBuild.cs
+
+	GPUCuller() : cullShader("gpuCull.cs"), hiZShader("hiZBuild.cs")
+	{
+		instanceCountUniform = cullShader.getUniform<int>("instanceCount");
+		frustumPlanesUniform = cullShader.getUniform<vec4>("frustumPlanes");
+		occlusionEnabledUniform = cullShader.getUniform<bool>("occlusionEnabled");
+		previousViewProjectionUniform = cullShader.getUniform<mat4>("previousViewProjection");
+		copyDepthUniform = hiZShader.getUniform<bool>("copyDepth");
+		sourceLevelUniform = hiZShader.getUniform<int>("sourceLevel");
+
+		instanceCount = 0;
+		instanceCapacity = 0;
+		hiZWidth = 0;
+		hiZHeight = 0;
+		hiZLevelCount = 0;
+		hiZValid = false;
+		depthTexture = 0;
+		hiZTexture = 0;
+
+		glGenBuffers(1, &instanceBuffer);
+		glGenBuffers(1, &meshBuffer);
+		glGenBuffers(1, &commandBuffer);
+	}
+
+	~GPUCuller()
+	{
+		GLState::DeleteBuffer(instanceBuffer);
+		GLState::DeleteBuffer(meshBuffer);
+		GLState::DeleteBuffer(commandBuffer);
+		DeleteTextures();
+	}
+
+	GPUCuller(const GPUCuller&) = delete;
+	GPUCuller& operator=(const GPUCuller&) = delete;
+
+	// Registers a mesh instances can refer to, meshes sharing an arena, index type and texture should be added together
+	int AddMesh(Object& object)
+	{
+		const MeshAllocation& allocation = object.GetAllocation();
+
+		Mesh mesh;
+		mesh.decodeMatrix = object.GetPositionDecodeMatrix();
+		mesh.boundingSphere = vec4(object.GetBoundingSphere().center, object.GetBoundingSphere().radius);
+		meshes.push_back(mesh);
+		meshObjects.push_back(&object);
+
+		DrawElementsIndirectCommand command;
+		command.count = allocation.indexCount;
+		command.instanceCount = 0;
+		command.firstIndex = allocation.indexOffset / MeshBuilder::IndexSize(allocation.indexType);
+		command.baseVertex = allocation.baseVertex;
+		command.baseInstance = 0;
+		commands.push_back(command);
+
+		GLState::BindBuffer(GL_ARRAY_BUFFER, meshBuffer);
+		glBufferData(GL_ARRAY_BUFFER, meshes.size() * sizeof(Mesh), meshes.data(), GL_STATIC_DRAW);
+		GLState::BindBuffer(GL_ARRAY_BUFFER, 0);
+		return (int)meshes.size() - 1;
+	}
+
+	// -1 when the object was not added, safe to call from any thread once every mesh is added
+	int FindMesh(const Object* object) const
+	{
+		for (size_t i = 0; i < meshObjects.size(); i++)
+		{
+			if (meshObjects[i] == object)
+			{
+				return (int)i;
+			}
+		}
+		return -1;
+	}
+
+	// Uploads every instance, they stay on the GPU until the next call
+	// Every instance's mesh has to be one returned by AddMesh
+	void SetInstances(const GPUInstance* instances, int count)
+	{
+#ifdef GL_VERSION_4_3
+		instanceCount = count;
+		if (count > instanceCapacity)
+		{
+			instanceCapacity = count > instanceCapacity * 2 ? count : instanceCapacity * 2;
+		}
+
+		GLState::BindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+		glBufferData(GL_ARRAY_BUFFER, instanceCapacity * sizeof(GPUInstance), NULL, GL_DYNAMIC_DRAW); // Orphaned, last frame's pass may still read it
+		glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(GPUInstance), instances);
+		GLState::BindBuffer(GL_ARRAY_BUFFER, 0);
+		visibleMatrices.Allocate(instanceCapacity);
+
+		// Every mesh gets a range of the output as large as its instance count, the pass fills it from the front
+		for (size_t i = 0; i < commands.size(); i++)
+		{
+			commands[i].instanceCount = 0;
+		}
+		for (int i = 0; i < count; i++)
+		{
+			assert(instances[i].mesh < commands.size());
+			commands[instances[i].mesh].instanceCount++;
+		}
+		unsigned int baseInstance = 0;
+		for (size_t i = 0; i < commands.size(); i++)
+		{
+			commands[i].baseInstance = baseInstance;
+			baseInstance += commands[i].instanceCount;
+			commands[i].instanceCount = 0;
+		}
+#endif
+	}
+
+	// Rewrites the world matrices of instances that moved, the rest of the buffer is left alone
+	void UpdateInstances(const GPUInstanceUpdate* updates, int count)
+	{
+#ifdef GL_VERSION_4_3
+		if (count == 0)
+		{
+			return;
+		}
+
+		GLState::BindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+		for (int i = 0; i < count; i++)
+		{
+			assert(updates[i].instance >= 0 && updates[i].instance < instanceCount);
+			glBufferSubData(GL_ARRAY_BUFFER, updates[i].instance * sizeof(GPUInstance), sizeof(mat4), &updates[i].worldMatrix);
+		}
+		GLState::BindBuffer(GL_ARRAY_BUFFER, 0);
+#endif
+	}
+
+	// Culls the instances into the indirect commands Draw submits
+	void Cull(const mat4& viewProjection)
+	{
+#ifdef GL_VERSION_4_3
+		int count = instanceCount;
+
+		// Instance counts start from 0, the pass increments them
+		GLState::BindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data(), GL_STREAM_DRAW);
+		GLState::BindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+		Frustum frustum = Frustum::FromMatrix(viewProjection);
+		cullShader.use();
+		cullShader.set(instanceCountUniform, count);
+		cullShader.set(frustumPlanesUniform, frustum.planes, 6);
+		cullShader.set(occlusionEnabledUniform, hiZValid);
+		cullShader.set(previousViewProjectionUniform, previousViewProjection);
+
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instanceBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, meshBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, commandBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, visibleMatrices.GetID());
+		GLState::ActiveTexture(0);
+		GLState::BindTexture(GL_TEXTURE_2D, hiZTexture);
+
+		glDispatchCompute((count + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+
+		// The next commands read the results as indirect parameters and instance attributes
+		glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+		this->viewProjection = viewProjection;
+#endif
+	}
+
+	// Draws the survivors of the last Cull with the bound program, which must read instanced matrices
+	// One glMultiDrawElementsIndirect per run of meshes sharing an arena, index type and texture
+	void Draw()
+	{
+#ifdef GL_VERSION_4_3
+		GLState::BindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+		size_t first = 0;
+		while (first < meshObjects.size())
+		{
+			Object& object = *meshObjects[first];
+			size_t last = first + 1;
+			while (last < meshObjects.size() && &meshObjects[last]->GetArena() == &object.GetArena() &&
+				   meshObjects[last]->GetAllocation().indexType == object.GetAllocation().indexType && meshObjects[last]->GetTexture() == object.GetTexture())
+			{
+				last++;
+			}
+
+			MeshArena& arena = object.GetArena();
+			if (arena.GetInstanceBuffer() != &visibleMatrices)
+			{
+				arena.SetInstanceBuffer(visibleMatrices);
+			}
+			arena.Bind();
+			GLState::ActiveTexture(0);
+			GLState::BindTexture(GL_TEXTURE_2D, object.GetTexture());
+
+			glMultiDrawElementsIndirect(GL_TRIANGLES, object.GetAllocation().indexType, (void*)(first * sizeof(DrawElementsIndirectCommand)), (GLsizei)(last - first), 0);
+			first = last;
+		}
+		GLState::BindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+#endif
+	}
+
+	// Call once the frame is drawn, the pyramid is what the next frame's Cull tests against
+	// Reads the depth of the default framebuffer, width and height are its size in pixels
+	void BuildHiZ(int width, int height)
+	{
+#ifdef GL_VERSION_4_3
+		if (width <= 0 || height <= 0)
+		{
+			hiZValid = false; // Minimized
+			return;
+		}
+		if (width != hiZWidth || height != hiZHeight)
+		{
+			CreateTextures(width, height);
+		}
+
+		GLState::ActiveTexture(0);
+		GLState::BindTexture(GL_TEXTURE_2D, depthTexture);
+		glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, width, height);
+
+		// Level 0 is a copy of the depth, every other level the farthest of the level above
+		hiZShader.use();
+		int levelWidth = width, levelHeight = height;
+		for (int level = 0; level < hiZLevelCount; level++)
+		{
+			hiZShader.set(copyDepthUniform, level == 0);
+			hiZShader.set(sourceLevelUniform, level - 1);
+			GLState::BindTexture(GL_TEXTURE_2D, level == 0 ? depthTexture : hiZTexture);
+			glBindImageTexture(0, hiZTexture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+
+			glDispatchCompute((levelWidth + HI_Z_GROUP_SIZE - 1) / HI_Z_GROUP_SIZE, (levelHeight + HI_Z_GROUP_SIZE - 1) / HI_Z_GROUP_SIZE, 1);
+			glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+			levelWidth = std::max(1, levelWidth / 2);
+			levelHeight = std::max(1, levelHeight / 2);
+		}
+
+		previousViewProjection = viewProjection;
+		hiZValid = true;
+#endif
+	}
+
+	int GetInstanceCount() const
+	{
+		return instanceCount;
+	}
+
+private:
+	// Mirrors the std430 Mesh struct of gpuCull.cs
+	struct Mesh
+	{
+		mat4 decodeMatrix;
+		vec4 boundingSphere; // Object space center and radius
+	};
+
+	Shader cullShader;
+	Shader hiZShader;
+	UniformHandle<int> instanceCountUniform;
+	UniformHandle<vec4> frustumPlanesUniform;
+	UniformHandle<bool> occlusionEnabledUniform;
+	UniformHandle<mat4> previousViewProjectionUniform;
+	UniformHandle<bool> copyDepthUniform;
+	UniformHandle<int> sourceLevelUniform;
+
+	vector<Mesh> meshes;
+	vector<Object*> meshObjects;
+	vector<DrawElementsIndirectCommand> commands; // Templates, instance counts are filled on the GPU
+
+	unsigned int instanceBuffer, meshBuffer, commandBuffer;
+	InstanceBuffer visibleMatrices; // Draw matrices of the survivors, grouped by mesh
+	int instanceCount;
+	int instanceCapacity;
+
+	unsigned int depthTexture, hiZTexture;
+	int hiZWidth, hiZHeight, hiZLevelCount;
+	bool hiZValid; // False until a frame has been drawn, nothing is occluded before that
+	mat4 viewProjection;
+	mat4 previousViewProjection; // Camera the pyramid was drawn with
+
+	void CreateTextures(int width, int height)
+	{
+#ifdef GL_VERSION_4_3
+		DeleteTextures();
+		hiZWidth = width;
+		hiZHeight = height;
+		hiZLevelCount = 1;
+		while ((std::max(width, height) >> hiZLevelCount) > 0)
+		{
+			hiZLevelCount++;
+		}
+
+		GLState::ActiveTexture(0);
+		glGenTextures(1, &depthTexture);
+		GLState::BindTexture(GL_TEXTURE_2D, depthTexture);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, width, height);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+		glGenTextures(1, &hiZTexture);
+		GLState::BindTexture(GL_TEXTURE_2D, hiZTexture);
+		glTexStorage2D(GL_TEXTURE_2D, hiZLevelCount, GL_R32F, width, height);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		hiZValid = false;
+#endif
+	}
+
+	void DeleteTextures()
+	{
+		if (depthTexture != 0)
+		{
+			glDeleteTextures(1, &depthTexture);
+			glDeleteTextures(1, &hiZTexture);
+			GLState::Invalidate(); // Deleting bound textures unbinds them
+			depthTexture = 0;
+			hiZTexture = 0;
+		}
+	}
+};
+
+#endif
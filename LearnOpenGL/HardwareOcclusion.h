@@ -0,0 +1,205 @@
+#ifndef HARDWARE_OCCLUSION_H
+#define HARDWARE_OCCLUSION_H
+
+#include "GLState.h"
+#include "Shader.h"
+
+#include <glad/glad.h>
+#include <glm/glm/glm.hpp>
+#include <vector>
+
+using namespace std;
+using namespace glm;
+
+// GPU occlusion culling with GL_ANY_SAMPLES_PASSED queries, one slot per object
+// Each frame the visible objects' bounding boxes are drawn into queries after the scene, color and depth writes off
+// The next frame draws each object under conditional rendering on its last query, so hidden objects cost no shading
+// Results are also read back for statistics, only once GL reports them available, so the CPU never waits
+class HardwareOcclusion
+{
+public:
+	// Queries kept per slot, results arrive a frame or two late and a query is not reused before then
+	static const int QUERY_RING_SIZE = 3;
+
+	HardwareOcclusion(int slotCount) : boxShader("occlusionBox.vs", "occlusionBox.fs")
+	{
+		boundsMinUniform = boxShader.getUniform<vec3>("boundsMin");
+		boundsSizeUniform = boxShader.getUniform<vec3>("boundsSize");
+		frame = 0;
+		occludedCount = 0;
+		querying = false;
+
+		slots.resize(slotCount);
+		for (Slot& slot : slots)
+		{
+			glGenQueries(QUERY_RING_SIZE, slot.queries);
+			for (int i = 0; i < QUERY_RING_SIZE; i++)
+			{
+				slot.issuedFrames[i] = -1;
+			}
+			slot.lastIssuedFrame = -1;
+			slot.next = 0;
+			slot.visible = true;
+		}
+
+		CreateBox();
+	}
+
+	~HardwareOcclusion()
+	{
+		for (Slot& slot : slots)
+		{
+			glDeleteQueries(QUERY_RING_SIZE, slot.queries);
+		}
+		GLState::DeleteBuffer(boxVBO);
+		GLState::DeleteBuffer(boxEBO);
+		glDeleteVertexArrays(1, &boxVAO);
+		GLState::Invalidate();
+	}
+
+	HardwareOcclusion(const HardwareOcclusion&) = delete;
+	HardwareOcclusion& operator=(const HardwareOcclusion&) = delete;
+
+	// Start of a frame, collects every result that is ready without blocking
+	void BeginFrame()
+	{
+		frame++;
+		occludedCount = 0;
+		for (Slot& slot : slots)
+		{
+			// Oldest first, GL completes queries in order
+			bool read = false;
+			for (int i = 0; i < QUERY_RING_SIZE; i++)
+			{
+				int index = (slot.next + i) % QUERY_RING_SIZE;
+				if (slot.issuedFrames[index] == -1)
+				{
+					continue;
+				}
+
+				GLuint available = GL_FALSE;
+				glGetQueryObjectuiv(slot.queries[index], GL_QUERY_RESULT_AVAILABLE, &available);
+				if (!available)
+				{
+					break;
+				}
+
+				GLuint samplesPassed = 0;
+				glGetQueryObjectuiv(slot.queries[index], GL_QUERY_RESULT, &samplesPassed);
+				slot.visible = samplesPassed != 0;
+				slot.issuedFrames[index] = -1;
+				read = true;
+			}
+			occludedCount += read && !slot.visible ? 1 : 0;
+		}
+	}
+
+	// Query to condition the slot's draw on, 0 (draw unconditionally) when it was not tested last frame
+	GLuint GetConditionQuery(int slot) const
+	{
+		const Slot& queried = slots[slot];
+		int last = (queried.next + QUERY_RING_SIZE - 1) % QUERY_RING_SIZE;
+		return queried.lastIssuedFrame == frame - 1 ? queried.queries[last] : 0;
+	}
+
+	// Draws the box into a new query of the slot, call after the scene so it tests against the frame's depth
+	void Query(int slot, const vec3& boundsMin, const vec3& boundsMax)
+	{
+		if (!querying)
+		{
+			BeginQueries();
+		}
+
+		Slot& queried = slots[slot];
+		GLuint query = queried.queries[queried.next];
+		queried.issuedFrames[queried.next] = frame; // An unread result in this query is dropped
+		queried.lastIssuedFrame = frame;
+		queried.next = (queried.next + 1) % QUERY_RING_SIZE;
+
+		boxShader.set(boundsMinUniform, boundsMin);
+		boxShader.set(boundsSizeUniform, boundsMax - boundsMin);
+		glBeginQuery(GL_ANY_SAMPLES_PASSED, query);
+		glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_BYTE, 0);
+		glEndQuery(GL_ANY_SAMPLES_PASSED);
+	}
+
+	// Restores the writes turned off for the boxes
+	void EndQueries()
+	{
+		if (!querying)
+		{
+			return;
+		}
+		GLState::SetColorMask(true);
+		GLState::SetDepthMask(true);
+		querying = false;
+	}
+
+	// Results read back by the last BeginFrame that saw no samples
+	int GetOccludedCount() const
+	{
+		return occludedCount;
+	}
+
+private:
+	struct Slot
+	{
+		GLuint queries[QUERY_RING_SIZE];
+		long long issuedFrames[QUERY_RING_SIZE]; // -1 once read or never issued
+		long long lastIssuedFrame;
+		int next; // Ring position of the next query
+		bool visible; // Latest result read back
+	};
+
+	Shader boxShader;
+	UniformHandle<vec3> boundsMinUniform;
+	UniformHandle<vec3> boundsSizeUniform;
+	unsigned int boxVAO, boxVBO, boxEBO;
+
+	vector<Slot> slots;
+	long long frame;
+	int occludedCount;
+	bool querying;
+
+	void BeginQueries()
+	{
+		boxShader.use();
+		GLState::BindVertexArray(boxVAO);
+		GLState::SetColorMask(false);
+		GLState::SetDepthMask(false);
+		GLState::SetEnabled(GL_DEPTH_TEST, true);
+		GLState::SetEnabled(GL_CULL_FACE, false); // Back faces still count when the camera is inside a box
+		querying = true;
+	}
+
+	// Unit cube from (0, 0, 0) to (1, 1, 1)
+	void CreateBox()
+	{
+		const float corners[] =
+		{
+			0.0f, 0.0f, 0.0f,  1.0f, 0.0f, 0.0f,  1.0f, 1.0f, 0.0f,  0.0f, 1.0f, 0.0f,
+			0.0f, 0.0f, 1.0f,  1.0f, 0.0f, 1.0f,  1.0f, 1.0f, 1.0f,  0.0f, 1.0f, 1.0f
+		};
+		const unsigned char indices[] =
+		{
+			0, 2, 1, 0, 3, 2,  4, 5, 6, 4, 6, 7,  0, 1, 5, 0, 5, 4,
+			3, 7, 6, 3, 6, 2,  0, 4, 7, 0, 7, 3,  1, 2, 6, 1, 6, 5
+		};
+
+		glGenVertexArrays(1, &boxVAO);
+		glGenBuffers(1, &boxVBO);
+		glGenBuffers(1, &boxEBO);
+
+		GLState::BindVertexArray(boxVAO);
+		GLState::BindBuffer(GL_ARRAY_BUFFER, boxVBO);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+		GLState::BindBuffer(GL_ELEMENT_ARRAY_BUFFER, boxEBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+		glEnableVertexAttribArray(0);
+		GLState::BindVertexArray(0);
+	}
+};
+
+#endif
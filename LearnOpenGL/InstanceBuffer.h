@@ -0,0 +1,85 @@
+#ifndef INSTANCE_BUFFER_H
+#define INSTANCE_BUFFER_H
+
+#include "GLState.h"
+
+#include <glad/glad.h>
+#include <glm/glm/glm.hpp>
+#include <glm/glm/gtc/type_ptr.hpp>
+
+using namespace glm;
+
+// Stores one model matrix per instance, consumed by glDraw*Instanced calls
+class InstanceBuffer
+{
+public:
+	InstanceBuffer()
+	{
+		capacity = 0;
+		count = 0;
+
+		glGenBuffers(1, &VBO);
+	}
+
+	// Attaches the matrix attribute to the currently bound VAO
+	// A mat4 attribute takes four consecutive locations, one vec4 column each
+	// firstInstance offsets the attribute, for contexts without base instance draws
+	void BindAttributes(unsigned int location, int firstInstance = 0)
+	{
+		GLState::BindBuffer(GL_ARRAY_BUFFER, VBO);
+
+		for (unsigned int column = 0; column < 4; column++)
+		{
+			glVertexAttribPointer(location + column, 4, GL_FLOAT, GL_FALSE, sizeof(mat4), (void*)(firstInstance * sizeof(mat4) + column * sizeof(vec4)));
+			glEnableVertexAttribArray(location + column);
+			glVertexAttribDivisor(location + column, 1); // Advance once per instance instead of once per vertex
+		}
+	}
+
+	void Upload(const mat4* matrices, int count)
+	{
+		this->count = count;
+
+		GLState::BindBuffer(GL_ARRAY_BUFFER, VBO);
+		if (count > capacity)
+		{
+			// Grow geometrically so a growing scene does not reallocate every frame
+			capacity = count > capacity * 2 ? count : capacity * 2;
+		}
+
+		// Orphans the previous storage so the driver does not wait for draws still reading it
+		glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(mat4), NULL, GL_STREAM_DRAW);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(mat4), matrices);
+	}
+
+	// Sizes the buffer for matrices written on the GPU, the previous contents are dropped
+	void Allocate(int count)
+	{
+		this->count = count;
+
+		GLState::BindBuffer(GL_ARRAY_BUFFER, VBO);
+		if (count > capacity)
+		{
+			capacity = count > capacity * 2 ? count : capacity * 2;
+		}
+		glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(mat4), NULL, GL_STREAM_DRAW);
+	}
+
+	int GetCount()
+	{
+		return count;
+	}
+
+	unsigned int GetID()
+	{
+		return VBO;
+	}
+
+private:
+	unsigned int VBO;
+
+	int capacity;
+	int count;
+};
+
+#endif
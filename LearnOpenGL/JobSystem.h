@@ -0,0 +1,512 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+enum JobPriority
+{
+	HIGH_PRIORITY,		// Work the current frame waits on
+	NORMAL_PRIORITY,
+	LOW_PRIORITY,		// Background work, asset decoding
+	PRIORITY_COUNT
+};
+
+// Number of spawned jobs not finished yet, waited on with JobSystem::Wait
+class JobCounter
+{
+public:
+	JobCounter() : value(0)
+	{
+	}
+
+	bool IsDone() const
+	{
+		return value.load(memory_order_acquire) == 0;
+	}
+
+private:
+	friend class JobSystem;
+	atomic<int> value;
+};
+
+// A function and its captured data stored inline, 128 bytes aligned to cache lines so neighbouring jobs never share one
+struct alignas(64) Job
+{
+	static const int PAYLOAD_SIZE = 96;
+
+	void (*function)(Job& job);
+	JobCounter* counter;
+	atomic<bool> inUse;	// Queued or running, the pool slot cannot be reused yet
+	alignas(16) unsigned char payload[PAYLOAD_SIZE];
+
+	Job() : function(NULL), counter(NULL), inUse(false)
+	{
+	}
+};
+
+// Chase-Lev deque (with the C11 orderings of Le et al.), the owner pushes and pops at the bottom, thieves take from the top
+class WorkStealingDeque
+{
+public:
+	static const int CAPACITY = 4096;
+
+	WorkStealingDeque() : top(0), bottom(0)
+	{
+		for (int i = 0; i < CAPACITY; i++)
+		{
+			jobs[i].store(NULL, memory_order_relaxed);
+		}
+	}
+
+	// Owner only, false when full
+	bool Push(Job* job)
+	{
+		long long b = bottom.load(memory_order_relaxed);
+		long long t = top.load(memory_order_acquire);
+		if (b - t >= CAPACITY)
+		{
+			return false;
+		}
+
+		jobs[b & (CAPACITY - 1)].store(job, memory_order_relaxed);
+		atomic_thread_fence(memory_order_release);
+		bottom.store(b + 1, memory_order_relaxed);
+		return true;
+	}
+
+	// Owner only, newest job first
+	Job* Pop()
+	{
+		long long b = bottom.load(memory_order_relaxed) - 1;
+		bottom.store(b, memory_order_relaxed);
+		atomic_thread_fence(memory_order_seq_cst);
+		long long t = top.load(memory_order_relaxed);
+
+		if (t > b)
+		{
+			// Empty
+			bottom.store(b + 1, memory_order_relaxed);
+			return NULL;
+		}
+
+		Job* job = jobs[b & (CAPACITY - 1)].load(memory_order_relaxed);
+		if (t == b)
+		{
+			// Last job, races with thieves for it
+			if (!top.compare_exchange_strong(t, t + 1, memory_order_seq_cst, memory_order_relaxed))
+			{
+				job = NULL;
+			}
+			bottom.store(b + 1, memory_order_relaxed);
+		}
+		return job;
+	}
+
+	// Any thread, oldest job first, NULL when empty or when another thief won
+	Job* Steal()
+	{
+		long long t = top.load(memory_order_acquire);
+		atomic_thread_fence(memory_order_seq_cst);
+		long long b = bottom.load(memory_order_acquire);
+		if (t >= b)
+		{
+			return NULL;
+		}
+
+		Job* job = jobs[t & (CAPACITY - 1)].load(memory_order_relaxed);
+		if (!top.compare_exchange_strong(t, t + 1, memory_order_seq_cst, memory_order_relaxed))
+		{
+			return NULL;
+		}
+		return job;
+	}
+
+	bool IsEmpty() const
+	{
+		return bottom.load(memory_order_relaxed) <= top.load(memory_order_relaxed);
+	}
+
+private:
+	// Padded apart, thieves write top while the owner writes bottom
+	atomic<long long> top;
+	char topPadding[64 - sizeof(atomic<long long>)];
+	atomic<long long> bottom;
+	char bottomPadding[64 - sizeof(atomic<long long>)];
+	atomic<Job*> jobs[CAPACITY];
+};
+
+// Work stealing scheduler, one worker per core with the main thread as worker 0
+// Each worker has a deque per priority, spawns go to the spawning worker's deque and idle workers steal from the others
+// Waiting on a counter runs other jobs instead of blocking, so jobs can spawn and wait on jobs of their own
+// Jobs come from a per-worker ring of JOB_POOL_SIZE, spawns that find their slot still in flight run immediately
+class JobSystem
+{
+public:
+	static const int JOB_POOL_SIZE = 4096;
+
+	// Per-worker execution counts, for the benchmarks
+	struct WorkerStats
+	{
+		long long executedJobs;
+		long long stolenJobs;
+	};
+
+	// Call from the main thread, 0 worker threads uses one per remaining hardware thread
+	// externalThreadCount reserves workers for threads created elsewhere, see AttachThread
+	static void Initialize(int workerThreadCount = 0, int externalThreadCount = 0)
+	{
+		JobSystem& system = Instance();
+		if (!system.workers.empty())
+		{
+			return;
+		}
+
+		if (workerThreadCount <= 0)
+		{
+			workerThreadCount = std::max(1, (int)thread::hardware_concurrency() - 1);
+		}
+
+		system.quit = false;
+		for (int i = 0; i < workerThreadCount + 1 + externalThreadCount; i++)
+		{
+			system.workers.push_back(unique_ptr<Worker>(new Worker()));
+		}
+		system.nextExternalWorker = workerThreadCount + 1;
+		WorkerIndex() = 0;
+
+		for (int i = 1; i <= workerThreadCount; i++)
+		{
+			system.threads.push_back(thread(&JobSystem::WorkerLoop, &system, i));
+		}
+	}
+
+	static void Shutdown()
+	{
+		JobSystem& system = Instance();
+		{
+			lock_guard<mutex> lock(system.sleepMutex);
+			system.quit = true;
+		}
+		system.wakeCondition.notify_all();
+
+		for (size_t i = 0; i < system.threads.size(); i++)
+		{
+			system.threads[i].join();
+		}
+		system.threads.clear();
+		system.workers.clear();
+		WorkerIndex() = -1;
+	}
+
+	// Makes the calling thread one of the reserved external workers, so it can spawn and wait on jobs
+	// It only runs jobs while it waits on a counter, the other workers steal what it spawns
+	static void AttachThread()
+	{
+		JobSystem& system = Instance();
+		int workerIndex = system.nextExternalWorker.fetch_add(1);
+		if (workerIndex < (int)system.workers.size())
+		{
+			WorkerIndex() = workerIndex;
+		}
+	}
+
+	static void DetachThread()
+	{
+		WorkerIndex() = -1;
+	}
+
+	// Workers including the main thread and external threads, 1 when not initialized
+	static int GetWorkerCount()
+	{
+		return std::max(1, (int)Instance().workers.size());
+	}
+
+	// Queues function() on the calling worker, counter (if any) is decremented once it ran
+	// function is copied into the job, its captures must fit in Job::PAYLOAD_SIZE
+	// Threads that are not workers (or an uninitialized system) run the function immediately
+	template <typename Function>
+	static void Spawn(const Function& function, JobCounter* counter = NULL, JobPriority priority = NORMAL_PRIORITY)
+	{
+		static_assert(sizeof(Function) <= Job::PAYLOAD_SIZE, "Job captures do not fit in the job payload");
+
+		JobSystem& system = Instance();
+		int workerIndex = WorkerIndex();
+		if (workerIndex == -1)
+		{
+			function();
+			return;
+		}
+
+		// Deeply nested waits can leave a whole pool of jobs in flight
+		Worker& worker = *system.workers[workerIndex];
+		Job* job = &worker.jobPool[worker.nextJob & (JOB_POOL_SIZE - 1)];
+		if (job->inUse.load(memory_order_acquire))
+		{
+			function();
+			return;
+		}
+		worker.nextJob++;
+
+		job->inUse.store(true, memory_order_relaxed);
+		job->function = &Invoke<Function>;
+		job->counter = counter;
+		new (job->payload) Function(function);
+
+		if (counter)
+		{
+			counter->value.fetch_add(1, memory_order_relaxed);
+		}
+
+		if (!worker.deques[priority].Push(job))
+		{
+			// Deque full, no point queueing more
+			Execute(*job);
+			return;
+		}
+
+		// No shared counter is written per job, sleepers are only looked up
+		// Pairs with the fence in WorkerLoop: either a sleeper sees the new job or this sees the sleeper
+		atomic_thread_fence(memory_order_seq_cst);
+		if (system.sleepingWorkers.load(memory_order_relaxed) > 0)
+		{
+			lock_guard<mutex> lock(system.sleepMutex);
+			system.wakeCondition.notify_one();
+		}
+	}
+
+	// Runs queued jobs until the counter reaches zero
+	static void Wait(const JobCounter& counter)
+	{
+		JobSystem& system = Instance();
+		int workerIndex = WorkerIndex();
+		while (!counter.IsDone())
+		{
+			if (workerIndex == -1 || !system.RunJob(workerIndex))
+			{
+				this_thread::yield();
+			}
+		}
+	}
+
+	// Calls function(begin, end) over [0, count) in chunks of grainSize, returns once every chunk is done
+	// The caller runs the first chunk itself
+	template <typename Function>
+	static void ParallelFor(int count, int grainSize, const Function& function, JobPriority priority = HIGH_PRIORITY)
+	{
+		if (count <= 0)
+		{
+			return;
+		}
+		grainSize = std::max(1, grainSize);
+
+		JobCounter counter;
+		const Function* body = &function;
+		for (int begin = grainSize; begin < count; begin += grainSize)
+		{
+			int end = std::min(begin + grainSize, count);
+			Spawn([body, begin, end]() { (*body)(begin, end); }, &counter, priority);
+		}
+
+		function(0, std::min(grainSize, count));
+		Wait(counter);
+	}
+
+	static WorkerStats GetWorkerStats(int workerIndex)
+	{
+		Worker& worker = *Instance().workers[workerIndex];
+		WorkerStats stats;
+		stats.executedJobs = worker.executedJobs.load(memory_order_relaxed);
+		stats.stolenJobs = worker.stolenJobs.load(memory_order_relaxed);
+		return stats;
+	}
+
+	static void ResetWorkerStats()
+	{
+		JobSystem& system = Instance();
+		for (size_t i = 0; i < system.workers.size(); i++)
+		{
+			system.workers[i]->executedJobs.store(0, memory_order_relaxed);
+			system.workers[i]->stolenJobs.store(0, memory_order_relaxed);
+		}
+	}
+
+private:
+	struct Worker
+	{
+		WorkStealingDeque deques[PRIORITY_COUNT];
+		vector<unsigned char> jobStorage; // One job larger than the pool, before C++17 vector<Job> would not honor its alignment
+		Job* jobPool;
+		unsigned int nextJob;
+		unsigned int randomState; // Victim selection
+
+		atomic<long long> executedJobs;
+		atomic<long long> stolenJobs;
+
+		Worker() : jobStorage((JOB_POOL_SIZE + 1) * sizeof(Job)), nextJob(0), executedJobs(0), stolenJobs(0)
+		{
+			void* storage = jobStorage.data();
+			size_t space = jobStorage.size();
+			jobPool = (Job*)std::align(alignof(Job), JOB_POOL_SIZE * sizeof(Job), storage, space);
+			for (int i = 0; i < JOB_POOL_SIZE; i++)
+			{
+				new (&jobPool[i]) Job();
+			}
+
+			randomState = (unsigned int)(size_t)this | 1;
+		}
+	};
+
+	vector<unique_ptr<Worker> > workers;
+	vector<thread> threads;
+
+	atomic<int> sleepingWorkers{ 0 }; // Only written when a worker goes to sleep or wakes up
+	atomic<int> nextExternalWorker{ 0 };
+	mutex sleepMutex;
+	condition_variable wakeCondition;
+	bool quit = false;
+
+	static JobSystem& Instance()
+	{
+		static JobSystem system;
+		return system;
+	}
+
+	// -1 on threads that are not workers
+	static int& WorkerIndex()
+	{
+		static thread_local int workerIndex = -1;
+		return workerIndex;
+	}
+
+	template <typename Function>
+	static void Invoke(Job& job)
+	{
+		Function* function = (Function*)job.payload;
+		(*function)();
+		function->~Function();
+	}
+
+	static void Execute(Job& job)
+	{
+		JobCounter* counter = job.counter;
+		job.function(job);
+		job.inUse.store(false, memory_order_release);
+		if (counter)
+		{
+			counter->value.fetch_sub(1, memory_order_release);
+		}
+	}
+
+	// Highest priority first, from the own deque before stealing
+	Job* FindJob(int workerIndex)
+	{
+		Worker& worker = *workers[workerIndex];
+		int workerCount = (int)workers.size();
+
+		for (int priority = 0; priority < PRIORITY_COUNT; priority++)
+		{
+			Job* job = worker.deques[priority].Pop();
+			if (job)
+			{
+				return job;
+			}
+
+			// Random starting victim so thieves spread out
+			worker.randomState ^= worker.randomState << 13;
+			worker.randomState ^= worker.randomState >> 17;
+			worker.randomState ^= worker.randomState << 5;
+			int start = (int)(worker.randomState % (unsigned int)workerCount);
+			for (int i = 0; i < workerCount; i++)
+			{
+				int victim = (start + i) % workerCount;
+				if (victim == workerIndex)
+				{
+					continue;
+				}
+
+				job = workers[victim]->deques[priority].Steal();
+				if (job)
+				{
+					worker.stolenJobs.fetch_add(1, memory_order_relaxed);
+					return job;
+				}
+			}
+		}
+		return NULL;
+	}
+
+	// Reads every deque's ends without taking anything, may miss jobs being pushed concurrently
+	bool HasQueuedJobs() const
+	{
+		for (const unique_ptr<Worker>& worker : workers)
+		{
+			for (int priority = 0; priority < PRIORITY_COUNT; priority++)
+			{
+				if (!worker->deques[priority].IsEmpty())
+				{
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	bool RunJob(int workerIndex)
+	{
+		Job* job = FindJob(workerIndex);
+		if (!job)
+		{
+			return false;
+		}
+
+		Execute(*job);
+		workers[workerIndex]->executedJobs.fetch_add(1, memory_order_relaxed);
+		return true;
+	}
+
+	void WorkerLoop(int workerIndex)
+	{
+		WorkerIndex() = workerIndex;
+
+		while (true)
+		{
+			if (RunJob(workerIndex))
+			{
+				continue;
+			}
+
+			// Spins briefly before sleeping, fine grained jobs usually come in bursts
+			bool found = false;
+			for (int spin = 0; spin < 64 && !found; spin++)
+			{
+				this_thread::yield();
+				found = HasQueuedJobs();
+			}
+			if (found)
+			{
+				continue;
+			}
+
+			unique_lock<mutex> lock(sleepMutex);
+			sleepingWorkers.fetch_add(1, memory_order_relaxed);
+			atomic_thread_fence(memory_order_seq_cst);
+			wakeCondition.wait(lock, [this]() { return quit || HasQueuedJobs(); });
+			sleepingWorkers.fetch_sub(1, memory_order_relaxed);
+			if (quit)
+			{
+				return;
+			}
+		}
+	}
+};
+
+#endif
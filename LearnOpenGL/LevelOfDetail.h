@@ -0,0 +1,74 @@
+#ifndef LEVEL_OF_DETAIL_H
+#define LEVEL_OF_DETAIL_H
+
+#include "EntityWorld.h"
+
+#include <glm/glm/glm.hpp>
+#include <algorithm>
+#include <cfloat>
+
+using namespace std;
+using namespace glm;
+
+// Projected size below which level 1 is used, every further level halves it
+// Sizes are the bounding sphere's diameter as a fraction of the screen height
+const float LOD_TRANSITION_SIZE = 0.25f;
+
+// Fraction a size has to go past a transition before the level changes, keeps objects near one from switching every frame
+const float LOD_HYSTERESIS = 0.1f;
+
+// Seconds a dithered cross-fade between two levels lasts
+const float LOD_FADE_TIME = 0.5f;
+
+// Picks discrete levels of detail from projected screen size
+class LodSelector
+{
+public:
+	// Diameter of a view space sphere over the screen height, works for perspective and orthographic projections
+	static float ProjectedSize(const vec3& viewCenter, float radius, const mat4& projection)
+	{
+		float w = projection[2][3] * viewCenter.z + projection[3][3];
+		if (w <= radius)
+		{
+			return FLT_MAX; // The camera is inside or right next to the sphere
+		}
+		return radius * projection[1][1] / w;
+	}
+
+	// Level for size given the current one, levels only change once size is past the transition by the hysteresis
+	static int SelectLod(float size, int currentLod, int lodCount)
+	{
+		int lod = std::min(currentLod, lodCount - 1);
+		while (lod + 1 < lodCount && size < TransitionSize(lod) * (1.0f - LOD_HYSTERESIS))
+		{
+			lod++;
+		}
+		while (lod > 0 && size > TransitionSize(lod - 1) * (1.0f + LOD_HYSTERESIS))
+		{
+			lod--;
+		}
+		return lod;
+	}
+
+	// Selects the entity's level and advances its fade, without crossFade levels switch at once
+	// A switch in the middle of a fade starts over from the level that was fading in
+	static void Update(LodComponent& lod, float size, int lodCount, float deltaTime, bool crossFade)
+	{
+		int selected = SelectLod(size, lod.lod, lodCount);
+		if (selected != lod.lod)
+		{
+			lod.previousLod = lod.lod;
+			lod.lod = selected;
+			lod.fade = crossFade ? 0.0f : 1.0f;
+		}
+		lod.fade = std::min(1.0f, lod.fade + deltaTime / LOD_FADE_TIME);
+	}
+
+	// Projected size below which level lod + 1 is used
+	static float TransitionSize(int lod)
+	{
+		return LOD_TRANSITION_SIZE / (float)(1 << lod);
+	}
+};
+
+#endif
@@ -0,0 +1,325 @@
+#ifndef MESH_ARENA_H
+#define MESH_ARENA_H
+
+#include "GLState.h"
+#include "InstanceBuffer.h"
+#include "VertexLayout.h"
+
+#include <glad/glad.h>
+#include <map>
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+// First fit free list over [0, capacity), neighbouring free ranges are merged when released
+class RangeAllocator
+{
+public:
+	RangeAllocator(int capacity)
+	{
+		this->capacity = 0;
+		Grow(capacity);
+	}
+
+	// Returns the offset of the range, or -1 when no free range is large enough
+	int Allocate(int size, int alignment)
+	{
+		for (map<int, int>::iterator block = freeRanges.begin(); block != freeRanges.end(); ++block)
+		{
+			int offset = (block->first + alignment - 1) / alignment * alignment;
+			int end = block->first + block->second;
+			if (offset + size > end)
+			{
+				continue;
+			}
+
+			// Keep whatever is left on both sides of the allocation
+			int blockOffset = block->first;
+			freeRanges.erase(block);
+			if (offset > blockOffset)
+			{
+				freeRanges[blockOffset] = offset - blockOffset;
+			}
+			if (offset + size < end)
+			{
+				freeRanges[offset + size] = end - (offset + size);
+			}
+			return offset;
+		}
+		return -1;
+	}
+
+	void Free(int offset, int size)
+	{
+		if (size == 0)
+		{
+			return;
+		}
+
+		map<int, int>::iterator block = freeRanges.insert(make_pair(offset, size)).first;
+
+		// Merge with the following range
+		map<int, int>::iterator next = block;
+		++next;
+		if (next != freeRanges.end() && block->first + block->second == next->first)
+		{
+			block->second += next->second;
+			freeRanges.erase(next);
+		}
+
+		// Merge with the preceding range
+		if (block != freeRanges.begin())
+		{
+			map<int, int>::iterator previous = block;
+			--previous;
+			if (previous->first + previous->second == block->first)
+			{
+				previous->second += block->second;
+				freeRanges.erase(block);
+			}
+		}
+	}
+
+	// Adds [capacity, newCapacity) to the free ranges
+	void Grow(int newCapacity)
+	{
+		int oldCapacity = capacity;
+		capacity = newCapacity;
+		Free(oldCapacity, newCapacity - oldCapacity);
+	}
+
+	int GetCapacity()
+	{
+		return capacity;
+	}
+
+private:
+	map<int, int> freeRanges; // Offset -> size
+	int capacity;
+};
+
+// Range of a mesh inside its arena, drawn with base vertex and first index offsets
+struct MeshAllocation
+{
+	int baseVertex;
+	int vertexCount;
+	int indexOffset;	// In bytes
+	int indexCount;
+	GLenum indexType;
+};
+
+// Shared vertex and index buffers for every mesh with the same vertex layout
+// Meshes are sub-allocated ranges of the same buffers, so they all draw from one VAO
+class MeshArena
+{
+public:
+	// Finds or creates the arena for a layout
+	static MeshArena& ForLayout(const VertexLayout& layout)
+	{
+		vector<unique_ptr<MeshArena> >& arenas = GetArenas();
+		for (size_t i = 0; i < arenas.size(); i++)
+		{
+			if (arenas[i]->layout == layout)
+			{
+				return *arenas[i];
+			}
+		}
+
+		arenas.push_back(unique_ptr<MeshArena>(new MeshArena(layout)));
+		arenas.back()->id = (unsigned int)arenas.size() - 1;
+		return *arenas.back();
+	}
+
+	// encodedStreams holds vertexCount vertices per stream of the layout
+	MeshAllocation Allocate(const vector<vector<unsigned char> >& encodedStreams, int vertexCount, const vector<unsigned char>& indexData, GLenum indexType)
+	{
+		MeshAllocation allocation;
+		allocation.vertexCount = vertexCount;
+		allocation.indexCount = (int)indexData.size() / (indexType == GL_UNSIGNED_SHORT ? 2 : 4);
+		allocation.indexType = indexType;
+
+		allocation.baseVertex = vertexAllocator.Allocate(vertexCount, 1);
+		while (allocation.baseVertex == -1)
+		{
+			GrowVertices(vertexAllocator.GetCapacity() * 2);
+			allocation.baseVertex = vertexAllocator.Allocate(vertexCount, 1);
+		}
+
+		// 4 byte aligned so 16 and 32 bit index ranges can share the buffer
+		allocation.indexOffset = indexAllocator.Allocate((int)indexData.size(), 4);
+		while (allocation.indexOffset == -1)
+		{
+			GrowIndices(indexAllocator.GetCapacity() * 2);
+			allocation.indexOffset = indexAllocator.Allocate((int)indexData.size(), 4);
+		}
+
+		for (size_t stream = 0; stream < VBOs.size(); stream++)
+		{
+			GLState::BindBuffer(GL_ARRAY_BUFFER, VBOs[stream]);
+			glBufferSubData(GL_ARRAY_BUFFER, allocation.baseVertex * layout.strides[stream], encodedStreams[stream].size(), encodedStreams[stream].data());
+		}
+		GLState::BindBuffer(GL_ARRAY_BUFFER, 0);
+
+		GLState::BindBuffer(GL_COPY_WRITE_BUFFER, EBO);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, allocation.indexOffset, indexData.size(), indexData.data());
+		GLState::BindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+		return allocation;
+	}
+
+	// Another index range over vertices already allocated, like a lower detail level of a mesh
+	// The allocation owns no vertices, freeing it only releases its indices
+	MeshAllocation AllocateIndices(const vector<unsigned char>& indexData, GLenum indexType, int baseVertex)
+	{
+		MeshAllocation allocation;
+		allocation.baseVertex = baseVertex;
+		allocation.vertexCount = 0;
+		allocation.indexCount = (int)indexData.size() / (indexType == GL_UNSIGNED_SHORT ? 2 : 4);
+		allocation.indexType = indexType;
+
+		allocation.indexOffset = indexAllocator.Allocate((int)indexData.size(), 4);
+		while (allocation.indexOffset == -1)
+		{
+			GrowIndices(indexAllocator.GetCapacity() * 2);
+			allocation.indexOffset = indexAllocator.Allocate((int)indexData.size(), 4);
+		}
+
+		GLState::BindBuffer(GL_COPY_WRITE_BUFFER, EBO);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, allocation.indexOffset, indexData.size(), indexData.data());
+		GLState::BindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+		return allocation;
+	}
+
+	void Free(const MeshAllocation& allocation)
+	{
+		vertexAllocator.Free(allocation.baseVertex, allocation.vertexCount);
+		indexAllocator.Free(allocation.indexOffset, allocation.indexCount * (allocation.indexType == GL_UNSIGNED_SHORT ? 2 : 4));
+	}
+
+	// Meshes of the same arena share its VAO, so switching between them skips the bind
+	void Bind()
+	{
+		GLState::BindVertexArray(VAO);
+	}
+
+	static void Unbind()
+	{
+		GLState::BindVertexArray(0);
+	}
+
+	// Per-instance model matrices -> layout (location = 2) to (location = 5), for every mesh of the arena
+	void SetInstanceBuffer(InstanceBuffer& instanceBuffer, int firstInstance = 0)
+	{
+		Bind();
+		instanceBuffer.BindAttributes(INSTANCE_MATRIX_LOCATION, firstInstance);
+		GLState::BindBuffer(GL_ARRAY_BUFFER, 0);
+		this->instanceBuffer = &instanceBuffer;
+	}
+
+	InstanceBuffer* GetInstanceBuffer()
+	{
+		return instanceBuffer;
+	}
+
+	const VertexLayout& GetLayout()
+	{
+		return layout;
+	}
+
+	// Index of the arena in creation order, used in render queue sort keys
+	unsigned int GetID()
+	{
+		return id;
+	}
+
+private:
+	unsigned int id;
+	VertexLayout layout;
+
+	unsigned int VAO;
+	vector<unsigned int> VBOs; // One per vertex stream
+	unsigned int EBO;
+
+	RangeAllocator vertexAllocator;	// In vertices
+	RangeAllocator indexAllocator;	// In bytes
+
+	InstanceBuffer* instanceBuffer;
+
+	MeshArena(const VertexLayout& layout) : vertexAllocator(65536), indexAllocator(256 * 1024)
+	{
+		this->layout = layout;
+		instanceBuffer = NULL;
+
+		glGenVertexArrays(1, &VAO);
+		Bind();
+
+		VBOs.resize(layout.GetStreamCount());
+		glGenBuffers((int)VBOs.size(), VBOs.data());
+		for (size_t stream = 0; stream < VBOs.size(); stream++)
+		{
+			GLState::BindBuffer(GL_ARRAY_BUFFER, VBOs[stream]);
+			glBufferData(GL_ARRAY_BUFFER, vertexAllocator.GetCapacity() * layout.strides[stream], NULL, GL_STATIC_DRAW);
+		}
+		layout.Apply(VBOs.data());
+
+		glGenBuffers(1, &EBO);
+		GLState::BindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexAllocator.GetCapacity(), NULL, GL_STATIC_DRAW);
+
+		Unbind();
+		GLState::BindBuffer(GL_ARRAY_BUFFER, 0);
+		GLState::BindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+
+	static vector<unique_ptr<MeshArena> >& GetArenas()
+	{
+		static vector<unique_ptr<MeshArena> > arenas;
+		return arenas;
+	}
+
+	// Moves the contents into a larger buffer, copied on the GPU
+	static unsigned int GrowBuffer(unsigned int buffer, int oldSize, int newSize)
+	{
+		unsigned int newBuffer;
+		glGenBuffers(1, &newBuffer);
+		GLState::BindBuffer(GL_COPY_WRITE_BUFFER, newBuffer);
+		glBufferData(GL_COPY_WRITE_BUFFER, newSize, NULL, GL_STATIC_DRAW);
+
+		GLState::BindBuffer(GL_COPY_READ_BUFFER, buffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, oldSize);
+
+		GLState::BindBuffer(GL_COPY_READ_BUFFER, 0);
+		GLState::BindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		GLState::DeleteBuffer(buffer);
+		return newBuffer;
+	}
+
+	void GrowVertices(int newCapacity)
+	{
+		for (size_t stream = 0; stream < VBOs.size(); stream++)
+		{
+			VBOs[stream] = GrowBuffer(VBOs[stream], vertexAllocator.GetCapacity() * layout.strides[stream], newCapacity * layout.strides[stream]);
+		}
+		vertexAllocator.Grow(newCapacity);
+
+		// The VAO still points at the deleted buffers
+		Bind();
+		layout.Apply(VBOs.data());
+		Unbind();
+		GLState::BindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	void GrowIndices(int newCapacity)
+	{
+		EBO = GrowBuffer(EBO, indexAllocator.GetCapacity(), newCapacity);
+		indexAllocator.Grow(newCapacity);
+
+		Bind();
+		GLState::BindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+		Unbind();
+	}
+};
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef MESH_BUILDER_H
+#define MESH_BUILDER_H
+
+#include <glad/glad.h>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+// Mesh preparation done once before the data is uploaded to the GPU
+class MeshBuilder
+{
+public:
+	// Merges vertices whose attributes are bit-identical and builds the matching index list
+	// stride is the number of floats per vertex
+	static void Weld(const vector<float>& vertices, int stride, vector<float>& weldedVertices, vector<unsigned int>& indices)
+	{
+		int vertexCount = (int)vertices.size() / stride;
+
+		weldedVertices.clear();
+		weldedVertices.reserve(vertices.size());
+		indices.resize(vertexCount);
+
+		// Open addressing table of welded vertex indices, kept at most half full
+		unsigned int tableSize = 1;
+		while (tableSize < (unsigned int)vertexCount * 2)
+		{
+			tableSize *= 2;
+		}
+		vector<int> table(tableSize, -1);
+
+		int weldedCount = 0;
+		for (int i = 0; i < vertexCount; i++)
+		{
+			const float* vertex = &vertices[i * stride];
+
+			unsigned int slot = Hash(vertex, stride) & (tableSize - 1);
+			while (table[slot] != -1 && memcmp(&weldedVertices[table[slot] * stride], vertex, stride * sizeof(float)) != 0)
+			{
+				slot = (slot + 1) & (tableSize - 1);
+			}
+
+			if (table[slot] == -1)
+			{
+				table[slot] = weldedCount++;
+				weldedVertices.insert(weldedVertices.end(), vertex, vertex + stride);
+			}
+			indices[i] = table[slot];
+		}
+	}
+
+	// Unit diameter UV sphere, position then texture coordinates per vertex (5 floats)
+	// The first and last columns are separate vertices so the texture wraps, the poles have one vertex per column
+	static void Sphere(int rings, int segments, vector<float>& vertices, vector<unsigned int>& indices)
+	{
+		const float pi = 3.14159265f;
+		vertices.clear();
+		indices.clear();
+
+		for (int ring = 0; ring <= rings; ring++)
+		{
+			float v = (float)ring / rings;
+			float y = cos(v * pi) * 0.5f;
+			float ringRadius = ring == 0 || ring == rings ? 0.0f : sin(v * pi) * 0.5f;
+			for (int segment = 0; segment <= segments; segment++)
+			{
+				// The last column repeats the first position exactly, only its texture coordinate differs
+				float u = (float)segment / segments;
+				float angle = (float)(segment % segments) / segments * 2.0f * pi;
+				float vertex[] = { cos(angle) * ringRadius, y, sin(angle) * ringRadius, u, 1.0f - v };
+				vertices.insert(vertices.end(), vertex, vertex + 5);
+			}
+		}
+
+		// Counter clockwise seen from outside, the triangles touching a pole are skipped since they would be degenerate
+		for (int ring = 0; ring < rings; ring++)
+		{
+			for (int segment = 0; segment < segments; segment++)
+			{
+				unsigned int topLeft = ring * (segments + 1) + segment;
+				unsigned int bottomLeft = topLeft + segments + 1;
+				if (ring != 0)
+				{
+					unsigned int triangle[] = { topLeft, topLeft + 1, bottomLeft };
+					indices.insert(indices.end(), triangle, triangle + 3);
+				}
+				if (ring != rings - 1)
+				{
+					unsigned int triangle[] = { topLeft + 1, bottomLeft + 1, bottomLeft };
+					indices.insert(indices.end(), triangle, triangle + 3);
+				}
+			}
+		}
+	}
+
+	// Packs indices into the smallest type that can address every vertex
+	// Returns GL_UNSIGNED_SHORT or GL_UNSIGNED_INT, to be passed to glDrawElements
+	static GLenum PackIndices(const vector<unsigned int>& indices, int vertexCount, vector<unsigned char>& indexData)
+	{
+		if (vertexCount <= 65536)
+		{
+			indexData.resize(indices.size() * sizeof(unsigned short));
+			unsigned short* shortIndices = (unsigned short*)indexData.data();
+			for (size_t i = 0; i < indices.size(); i++)
+			{
+				shortIndices[i] = (unsigned short)indices[i];
+			}
+			return GL_UNSIGNED_SHORT;
+		}
+
+		indexData.resize(indices.size() * sizeof(unsigned int));
+		memcpy(indexData.data(), indices.data(), indexData.size());
+		return GL_UNSIGNED_INT;
+	}
+
+	static int IndexSize(GLenum indexType)
+	{
+		return indexType == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+	}
+
+private:
+	// FNV-1a over the raw vertex bytes
+	static unsigned int Hash(const float* vertex, int stride)
+	{
+		const unsigned char* bytes = (const unsigned char*)vertex;
+		unsigned int hash = 2166136261u;
+		for (size_t i = 0; i < stride * sizeof(float); i++)
+		{
+			hash = (hash ^ bytes[i]) * 16777619u;
+		}
+		return hash;
+	}
+};
+
+#endif
@@ -0,0 +1,410 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <glm/glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace std;
+using namespace glm;
+
+// Post-transform cache statistics of an index buffer
+struct VertexCacheStats
+{
+	float ACMR; // Average cache miss ratio, vertex shader invocations per triangle (0.5 best, 3 worst)
+	float ATVR; // Average transformed vertex ratio, vertex shader invocations per vertex (1 best)
+};
+
+struct MeshOptimizationStats
+{
+	VertexCacheStats before;
+	VertexCacheStats after;
+};
+
+// Load time reordering of indexed triangle meshes
+// Triangles are reordered for the post-transform vertex cache (Forsyth), then grouped into clusters
+// sorted to reduce overdraw, and finally vertices are reordered in first use order for fetch locality
+class MeshOptimizer
+{
+public:
+	// Size of the simulated FIFO cache used for the statistics
+	static const int STATS_CACHE_SIZE = 16;
+
+	// Positions are the first three floats of every vertex, stride is the number of floats per vertex
+	static MeshOptimizationStats Optimize(vector<float>& vertices, int stride, vector<unsigned int>& indices)
+	{
+		int vertexCount = (int)vertices.size() / stride;
+
+		MeshOptimizationStats stats;
+		stats.before = AnalyzeVertexCache(indices, vertexCount, STATS_CACHE_SIZE);
+
+		OptimizeVertexCache(indices, vertexCount);
+		OptimizeOverdraw(indices, vertices, stride, 1.05f);
+		OptimizeVertexFetch(vertices, stride, indices);
+
+		stats.after = AnalyzeVertexCache(indices, (int)vertices.size() / stride, STATS_CACHE_SIZE);
+		return stats;
+	}
+
+	static VertexCacheStats AnalyzeVertexCache(const vector<unsigned int>& indices, int vertexCount, int cacheSize)
+	{
+		VertexCacheStats stats;
+		stats.ACMR = 0.0f;
+		stats.ATVR = 0.0f;
+		if (indices.empty() || vertexCount == 0)
+		{
+			return stats;
+		}
+
+		// FIFO cache, a vertex is in the cache while it was inserted less than cacheSize misses ago
+		vector<int> insertedAt(vertexCount, -cacheSize - 1);
+		int misses = 0;
+		for (size_t i = 0; i < indices.size(); i++)
+		{
+			if (misses - insertedAt[indices[i]] > cacheSize)
+			{
+				insertedAt[indices[i]] = misses;
+				misses++;
+			}
+		}
+
+		stats.ACMR = (float)misses / (indices.size() / 3);
+		stats.ATVR = (float)misses / vertexCount;
+		return stats;
+	}
+
+	// Forsyth's linear-speed vertex cache optimisation
+	// Greedily emits the triangle with the best score, scores favour vertices recently used and vertices with few triangles left
+	static void OptimizeVertexCache(vector<unsigned int>& indices, int vertexCount)
+	{
+		const int cacheSize = 32;
+		int triangleCount = (int)indices.size() / 3;
+		if (triangleCount == 0)
+		{
+			return;
+		}
+
+		// Vertex to triangle adjacency
+		vector<int> triangleOffsets(vertexCount + 1, 0);
+		for (size_t i = 0; i < indices.size(); i++)
+		{
+			triangleOffsets[indices[i] + 1]++;
+		}
+		for (int v = 0; v < vertexCount; v++)
+		{
+			triangleOffsets[v + 1] += triangleOffsets[v];
+		}
+
+		vector<int> adjacentTriangles(indices.size());
+		vector<int> liveTriangles(vertexCount, 0);
+		for (int t = 0; t < triangleCount; t++)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				int v = indices[t * 3 + k];
+				adjacentTriangles[triangleOffsets[v] + liveTriangles[v]++] = t;
+			}
+		}
+
+		vector<int> cachePosition(vertexCount, -1);
+		vector<float> vertexScore(vertexCount);
+		for (int v = 0; v < vertexCount; v++)
+		{
+			vertexScore[v] = VertexScore(-1, liveTriangles[v], cacheSize);
+		}
+
+		vector<float> triangleScore(triangleCount);
+		vector<bool> emitted(triangleCount, false);
+		for (int t = 0; t < triangleCount; t++)
+		{
+			triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+		}
+
+		vector<unsigned int> optimized;
+		optimized.reserve(indices.size());
+
+		vector<int> cache;
+		vector<int> newCache;
+		int scanPosition = 0;
+		int bestTriangle = -1;
+
+		for (int emittedCount = 0; emittedCount < triangleCount; emittedCount++)
+		{
+			// Nothing in the cache is adjacent to a live triangle, take the best remaining one
+			if (bestTriangle == -1)
+			{
+				float bestScore = -1.0f;
+				while (scanPosition < triangleCount && emitted[scanPosition])
+				{
+					scanPosition++;
+				}
+				for (int t = scanPosition; t < triangleCount; t++)
+				{
+					if (!emitted[t] && triangleScore[t] > bestScore)
+					{
+						bestScore = triangleScore[t];
+						bestTriangle = t;
+					}
+				}
+			}
+
+			// Emit it and move its vertices to the front of the LRU cache
+			emitted[bestTriangle] = true;
+			newCache.clear();
+			for (int k = 0; k < 3; k++)
+			{
+				int v = indices[bestTriangle * 3 + k];
+				optimized.push_back(v);
+				newCache.push_back(v);
+
+				int* adjacent = &adjacentTriangles[triangleOffsets[v]];
+				int live = liveTriangles[v]--;
+				for (int i = 0; i < live; i++)
+				{
+					if (adjacent[i] == bestTriangle)
+					{
+						swap(adjacent[i], adjacent[live - 1]);
+						break;
+					}
+				}
+			}
+			for (size_t i = 0; i < cache.size(); i++)
+			{
+				int v = cache[i];
+				if (v != newCache[0] && v != newCache[1] && v != newCache[2])
+				{
+					newCache.push_back(v);
+				}
+			}
+			cache.swap(newCache);
+
+			// Rescore every vertex that was or still is in the cache, and their triangles
+			for (size_t i = 0; i < newCache.size(); i++)
+			{
+				cachePosition[newCache[i]] = -1;
+			}
+			for (size_t i = 0; i < cache.size(); i++)
+			{
+				cachePosition[cache[i]] = i < (size_t)cacheSize ? (int)i : -1;
+			}
+
+			for (size_t i = 0; i < cache.size(); i++)
+			{
+				int v = cache[i];
+				float oldScore = vertexScore[v];
+				vertexScore[v] = VertexScore(cachePosition[v], liveTriangles[v], cacheSize);
+
+				for (int j = 0; j < liveTriangles[v]; j++)
+				{
+					triangleScore[adjacentTriangles[triangleOffsets[v] + j]] += vertexScore[v] - oldScore;
+				}
+			}
+
+			// Next triangle is the best one using a cached vertex
+			bestTriangle = -1;
+			float bestScore = -1.0f;
+			for (size_t i = 0; i < cache.size() && i < (size_t)cacheSize; i++)
+			{
+				int v = cache[i];
+				for (int j = 0; j < liveTriangles[v]; j++)
+				{
+					int t = adjacentTriangles[triangleOffsets[v] + j];
+					if (triangleScore[t] > bestScore)
+					{
+						bestScore = triangleScore[t];
+						bestTriangle = t;
+					}
+				}
+			}
+
+			if (cache.size() > (size_t)cacheSize)
+			{
+				cache.resize(cacheSize);
+			}
+		}
+
+		indices.swap(optimized);
+	}
+
+	// Splits the cache optimized triangle order into clusters and sorts them so outward facing clusters are drawn first
+	// A new cluster starts where the simulated cache restarts (all three vertices miss) or once the cluster ACMR
+	// drops below threshold times the mesh ACMR, which bounds the cache efficiency lost by reordering clusters (Tipsify)
+	static void OptimizeOverdraw(vector<unsigned int>& indices, const vector<float>& vertices, int stride, float threshold)
+	{
+		int vertexCount = (int)vertices.size() / stride;
+		int triangleCount = (int)indices.size() / 3;
+		if (triangleCount == 0)
+		{
+			return;
+		}
+
+		float meshACMR = AnalyzeVertexCache(indices, vertexCount, STATS_CACHE_SIZE).ACMR;
+
+		// Cluster boundaries
+		// Every cluster is simulated from a cold cache, since after sorting it can follow any other cluster
+		vector<int> clusterStarts;
+		vector<int> insertedAt(vertexCount, -STATS_CACHE_SIZE - 1);
+		int misses = 0;
+		int clusterStartMisses = 0;
+		int clusterMisses = 0;
+		int clusterTriangles = 0;
+		for (int t = 0; t < triangleCount; t++)
+		{
+			if (clusterTriangles > 0 && (float)clusterMisses / clusterTriangles <= meshACMR * threshold)
+			{
+				clusterStartMisses = misses;
+				clusterMisses = 0;
+				clusterTriangles = 0;
+			}
+
+			int triangleMisses = 0;
+			for (int k = 0; k < 3; k++)
+			{
+				int v = indices[t * 3 + k];
+				if (misses - insertedAt[v] > STATS_CACHE_SIZE || insertedAt[v] < clusterStartMisses)
+				{
+					insertedAt[v] = misses;
+					misses++;
+					triangleMisses++;
+				}
+			}
+
+			if (triangleMisses == 3)
+			{
+				clusterStartMisses = misses - 3;
+				clusterMisses = 0;
+				clusterTriangles = 0;
+			}
+			if (clusterTriangles == 0)
+			{
+				clusterStarts.push_back(t);
+			}
+			clusterMisses += triangleMisses;
+			clusterTriangles++;
+		}
+		clusterStarts.push_back(triangleCount);
+
+		// Mesh centroid, weighted by triangle area
+		vec3 meshCentroid(0.0f);
+		float meshArea = 0.0f;
+		for (int t = 0; t < triangleCount; t++)
+		{
+			vec3 a, b, c;
+			GetTriangle(indices, vertices, stride, t, a, b, c);
+			float area = length(cross(b - a, c - a));
+			meshCentroid += (a + b + c) * (area / 3.0f);
+			meshArea += area;
+		}
+		meshCentroid = meshArea > 0.0f ? meshCentroid / meshArea : meshCentroid;
+
+		// Clusters facing away from the mesh center are likely to occlude the rest, so they are drawn first
+		int clusterCount = (int)clusterStarts.size() - 1;
+		vector<float> sortKeys(clusterCount);
+		for (int i = 0; i < clusterCount; i++)
+		{
+			vec3 centroid(0.0f);
+			vec3 normal(0.0f);
+			float area = 0.0f;
+			for (int t = clusterStarts[i]; t < clusterStarts[i + 1]; t++)
+			{
+				vec3 a, b, c;
+				GetTriangle(indices, vertices, stride, t, a, b, c);
+				vec3 areaNormal = cross(b - a, c - a);
+				float triangleArea = length(areaNormal);
+				centroid += (a + b + c) * (triangleArea / 3.0f);
+				normal += areaNormal;
+				area += triangleArea;
+			}
+
+			float normalLength = length(normal);
+			if (area > 0.0f && normalLength > 0.0f)
+			{
+				sortKeys[i] = dot(centroid / area - meshCentroid, normal / normalLength);
+			}
+			else
+			{
+				sortKeys[i] = 0.0f;
+			}
+		}
+
+		vector<int> clusterOrder(clusterCount);
+		for (int i = 0; i < clusterCount; i++)
+		{
+			clusterOrder[i] = i;
+		}
+		stable_sort(clusterOrder.begin(), clusterOrder.end(), [&sortKeys](int a, int b) { return sortKeys[a] > sortKeys[b]; });
+
+		vector<unsigned int> sorted;
+		sorted.reserve(indices.size());
+		for (int i = 0; i < clusterCount; i++)
+		{
+			int cluster = clusterOrder[i];
+			sorted.insert(sorted.end(), indices.begin() + clusterStarts[cluster] * 3, indices.begin() + clusterStarts[cluster + 1] * 3);
+		}
+		indices.swap(sorted);
+	}
+
+	// Renumbers vertices in the order the index buffer first uses them, so vertex fetches walk memory linearly
+	// Vertices not referenced by any triangle are dropped
+	static void OptimizeVertexFetch(vector<float>& vertices, int stride, vector<unsigned int>& indices)
+	{
+		int vertexCount = (int)vertices.size() / stride;
+
+		vector<int> remap(vertexCount, -1);
+		vector<float> reordered;
+		reordered.reserve(vertices.size());
+
+		int nextVertex = 0;
+		for (size_t i = 0; i < indices.size(); i++)
+		{
+			int v = indices[i];
+			if (remap[v] == -1)
+			{
+				remap[v] = nextVertex++;
+				reordered.insert(reordered.end(), vertices.begin() + v * stride, vertices.begin() + (v + 1) * stride);
+			}
+			indices[i] = remap[v];
+		}
+
+		vertices.swap(reordered);
+	}
+
+private:
+	// Forsyth's scoring function
+	static float VertexScore(int cachePosition, int liveTriangles, int cacheSize)
+	{
+		if (liveTriangles == 0)
+		{
+			return -1.0f; // No triangle left to emit
+		}
+
+		float score = 0.0f;
+		if (cachePosition >= 0)
+		{
+			if (cachePosition < 3)
+			{
+				score = 0.75f; // Used by the last triangle, fixed score so triangles are not favoured by their order
+			}
+			else
+			{
+				score = pow(1.0f - (float)(cachePosition - 3) / (cacheSize - 3), 1.5f);
+			}
+		}
+
+		// Boosts vertices with few triangles left so they are finished and leave no lone triangles behind
+		return score + 2.0f * pow((float)liveTriangles, -0.5f);
+	}
+
+	static void GetTriangle(const vector<unsigned int>& indices, const vector<float>& vertices, int stride, int triangle, vec3& a, vec3& b, vec3& c)
+	{
+		const float* va = &vertices[indices[triangle * 3] * stride];
+		const float* vb = &vertices[indices[triangle * 3 + 1] * stride];
+		const float* vc = &vertices[indices[triangle * 3 + 2] * stride];
+		a = vec3(va[0], va[1], va[2]);
+		b = vec3(vb[0], vb[1], vb[2]);
+		c = vec3(vc[0], vc[1], vc[2]);
+	}
+};
+
+#endif
@@ -0,0 +1,426 @@
+#ifndef MESH_SIMPLIFIER_H
+#define MESH_SIMPLIFIER_H
+
+#include <glm/glm/glm.hpp>
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+using namespace glm;
+
+// Quadric error metric of a vertex (Garland and Heckbert), the sum of squared distances to a set of weighted planes
+// Stored as the symmetric 4x4 matrix's upper triangle
+struct Quadric
+{
+	float a00, a11, a22, a01, a02, a12; // n * n^T
+	float b0, b1, b2; // n * d
+	float c; // d * d
+	float weight;
+
+	Quadric()
+	{
+		memset(this, 0, sizeof(Quadric));
+	}
+
+	// Plane with unit normal n through distance d, dot(n, p) + d = 0
+	static Quadric FromPlane(const vec3& n, float d, float weight)
+	{
+		Quadric quadric;
+		quadric.a00 = n.x * n.x * weight;
+		quadric.a11 = n.y * n.y * weight;
+		quadric.a22 = n.z * n.z * weight;
+		quadric.a01 = n.x * n.y * weight;
+		quadric.a02 = n.x * n.z * weight;
+		quadric.a12 = n.y * n.z * weight;
+		quadric.b0 = n.x * d * weight;
+		quadric.b1 = n.y * d * weight;
+		quadric.b2 = n.z * d * weight;
+		quadric.c = d * d * weight;
+		quadric.weight = weight;
+		return quadric;
+	}
+
+	void Add(const Quadric& other)
+	{
+		a00 += other.a00; a11 += other.a11; a22 += other.a22;
+		a01 += other.a01; a02 += other.a02; a12 += other.a12;
+		b0 += other.b0; b1 += other.b1; b2 += other.b2;
+		c += other.c;
+		weight += other.weight;
+	}
+
+	// Weighted mean squared distance of p to the planes
+	float Evaluate(const vec3& p) const
+	{
+		float rx = a00 * p.x + a01 * p.y + a02 * p.z + b0;
+		float ry = a01 * p.x + a11 * p.y + a12 * p.z + b1;
+		float rz = a02 * p.x + a12 * p.y + a22 * p.z + b2;
+		float error = rx * p.x + ry * p.y + rz * p.z + (b0 * p.x + b1 * p.y + b2 * p.z) + c;
+		return weight > 0.0f ? fabs(error) / weight : 0.0f;
+	}
+};
+
+// Load time mesh simplification by edge collapse, used to build LOD chains
+// Vertices are only ever collapsed onto other existing vertices, so every level indexes the original vertex buffer
+// Vertices sharing a position with another (texture seams) and non-manifold ones stay put, border vertices only
+// slide along their border. Collapses are done in passes cheapest first, a pass freezes every vertex around
+// the collapses it made so its flip checks stay exact
+class MeshSimplifier
+{
+public:
+	// Positions are the first three floats of every vertex, stride is the number of floats per vertex
+	// Stops at targetIndexCount or once the next collapse would move the surface by more than maxError
+	// error receives the largest distance any collapse moved the surface by, in position units
+	static vector<unsigned int> Simplify(const vector<float>& vertices, int stride, const vector<unsigned int>& indices, size_t targetIndexCount, float maxError, float& error)
+	{
+		int vertexCount = (int)vertices.size() / stride;
+		vector<unsigned int> result(indices);
+		error = 0.0f;
+
+		vector<vec3> positions(vertexCount);
+		for (int v = 0; v < vertexCount; v++)
+		{
+			positions[v] = vec3(vertices[v * stride], vertices[v * stride + 1], vertices[v * stride + 2]);
+		}
+
+		// Vertices with the same position share one quadric
+		vector<int> positionIDs;
+		int positionCount = BuildPositionIDs(positions, positionIDs);
+		vector<Quadric> quadrics(positionCount);
+		AddTriangleQuadrics(positions, positionIDs, result, quadrics);
+
+		unordered_map<unsigned long long, int> edges;
+		vector<unsigned char> kinds;
+		CountEdges(positionIDs, result, edges);
+		ClassifyVertices(positionIDs, positionCount, edges, kinds);
+		AddBorderQuadrics(positions, positionIDs, result, edges, quadrics);
+
+		vector<int> remap(vertexCount);
+		vector<unsigned char> frozen(vertexCount);
+		vector<int> adjacencyOffsets, adjacency;
+		vector<Collapse> collapses;
+		float maxCost = maxError * maxError;
+
+		while (result.size() > targetIndexCount)
+		{
+			BuildAdjacency(vertexCount, result, adjacencyOffsets, adjacency);
+
+			// Both directions of every edge whose first vertex may move
+			collapses.clear();
+			for (size_t i = 0; i < result.size(); i += 3)
+			{
+				for (int k = 0; k < 3; k++)
+				{
+					unsigned int a = result[i + k], b = result[i + (k + 1) % 3];
+					bool border = edges.count(EdgeKey(positionIDs[b], positionIDs[a])) == 0;
+					AddCollapse(a, b, border, positions, positionIDs, kinds, quadrics, collapses);
+					AddCollapse(b, a, border, positions, positionIDs, kinds, quadrics, collapses);
+				}
+			}
+			sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) { return x.cost < y.cost; });
+
+			for (int v = 0; v < vertexCount; v++)
+			{
+				remap[v] = v;
+			}
+			fill(frozen.begin(), frozen.end(), (unsigned char)0);
+
+			size_t indexCount = result.size();
+			int collapsed = 0;
+			for (const Collapse& collapse : collapses)
+			{
+				if (indexCount <= targetIndexCount || collapse.cost > maxCost)
+				{
+					break;
+				}
+				if (frozen[collapse.from] || frozen[collapse.to] || Flips(collapse, positions, result, adjacencyOffsets, adjacency))
+				{
+					continue;
+				}
+
+				// Every vertex of the triangles around the moved vertex keeps its position until the next pass
+				for (int t = adjacencyOffsets[collapse.from]; t < adjacencyOffsets[collapse.from + 1]; t++)
+				{
+					const unsigned int* triangle = &result[adjacency[t] * 3];
+					frozen[triangle[0]] = frozen[triangle[1]] = frozen[triangle[2]] = 1;
+					if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to)
+					{
+						indexCount -= 3;
+					}
+				}
+
+				remap[collapse.from] = collapse.to;
+				quadrics[positionIDs[collapse.to]].Add(quadrics[positionIDs[collapse.from]]);
+				error = std::max(error, collapse.cost);
+				collapsed++;
+			}
+
+			if (collapsed == 0)
+			{
+				break;
+			}
+			ApplyRemap(remap, result);
+
+			edges.clear();
+			CountEdges(positionIDs, result, edges);
+			ClassifyVertices(positionIDs, positionCount, edges, kinds);
+		}
+
+		error = sqrt(error);
+		return result;
+	}
+
+private:
+	enum VertexKind
+	{
+		MANIFOLD_VERTEX,	// Moves freely
+		BORDER_VERTEX,		// On an open edge, moves along it
+		LOCKED_VERTEX		// Seams, non-manifold and complex borders
+	};
+
+	struct Collapse
+	{
+		unsigned int from;
+		unsigned int to;
+		float cost;
+	};
+
+	static int BuildPositionIDs(const vector<vec3>& positions, vector<int>& positionIDs)
+	{
+		unordered_map<unsigned long long, int> hashed;
+		positionIDs.resize(positions.size());
+		int positionCount = 0;
+		vector<int> firstVertex;
+		for (size_t v = 0; v < positions.size(); v++)
+		{
+			// Adding zero turns -0 into 0, both have to hash the same
+			vec3 position = positions[v] + vec3(0.0f);
+			unsigned int bits[3];
+			memcpy(bits, &position, sizeof(bits));
+			unsigned long long key = bits[0] * 73856093ull ^ bits[1] * 19349663ull ^ bits[2] * 83492791ull;
+
+			// Hash collisions of different positions chain through neighbouring keys
+			int id = -1;
+			for (;; key++)
+			{
+				unordered_map<unsigned long long, int>::iterator found = hashed.find(key);
+				if (found == hashed.end())
+				{
+					break;
+				}
+				if (positions[firstVertex[found->second]] == positions[v])
+				{
+					id = found->second;
+					break;
+				}
+			}
+
+			if (id == -1)
+			{
+				id = positionCount++;
+				hashed[key] = id;
+				firstVertex.push_back((int)v);
+			}
+			positionIDs[v] = id;
+		}
+		return positionCount;
+	}
+
+	// Area weighted triangle planes
+	static void AddTriangleQuadrics(const vector<vec3>& positions, const vector<int>& positionIDs, const vector<unsigned int>& indices, vector<Quadric>& quadrics)
+	{
+		for (size_t i = 0; i < indices.size(); i += 3)
+		{
+			const vec3& p0 = positions[indices[i]];
+			vec3 normal = cross(positions[indices[i + 1]] - p0, positions[indices[i + 2]] - p0);
+			float area = length(normal);
+			if (area == 0.0f)
+			{
+				continue;
+			}
+			normal /= area;
+
+			Quadric quadric = Quadric::FromPlane(normal, -dot(normal, p0), area * 0.5f);
+			for (int k = 0; k < 3; k++)
+			{
+				quadrics[positionIDs[indices[i + k]]].Add(quadric);
+			}
+		}
+	}
+
+	// Planes through every border edge, perpendicular to its triangle, keep borders from shrinking
+	static void AddBorderQuadrics(const vector<vec3>& positions, const vector<int>& positionIDs, const vector<unsigned int>& indices, const unordered_map<unsigned long long, int>& edges, vector<Quadric>& quadrics)
+	{
+		for (size_t i = 0; i < indices.size(); i += 3)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				unsigned int a = indices[i + k], b = indices[i + (k + 1) % 3], c = indices[i + (k + 2) % 3];
+				if (edges.count(EdgeKey(positionIDs[b], positionIDs[a])) != 0)
+				{
+					continue;
+				}
+
+				vec3 edge = positions[b] - positions[a];
+				vec3 normal = cross(edge, cross(edge, positions[c] - positions[a]));
+				float normalLength = length(normal);
+				if (normalLength == 0.0f)
+				{
+					continue;
+				}
+				normal /= normalLength;
+
+				Quadric quadric = Quadric::FromPlane(normal, -dot(normal, positions[a]), dot(edge, edge) * 10.0f);
+				quadrics[positionIDs[a]].Add(quadric);
+				quadrics[positionIDs[b]].Add(quadric);
+			}
+		}
+	}
+
+	static unsigned long long EdgeKey(int a, int b)
+	{
+		return ((unsigned long long)(unsigned int)a << 32) | (unsigned int)b;
+	}
+
+	// Directed edges between positions, a closed manifold surface has every edge once in each direction
+	static void CountEdges(const vector<int>& positionIDs, const vector<unsigned int>& indices, unordered_map<unsigned long long, int>& edges)
+	{
+		edges.reserve(indices.size());
+		for (size_t i = 0; i < indices.size(); i += 3)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				edges[EdgeKey(positionIDs[indices[i + k]], positionIDs[indices[i + (k + 1) % 3]])]++;
+			}
+		}
+	}
+
+	static void ClassifyVertices(const vector<int>& positionIDs, int positionCount, const unordered_map<unsigned long long, int>& edges, vector<unsigned char>& kinds)
+	{
+		int vertexCount = (int)positionIDs.size();
+		kinds.assign(vertexCount, MANIFOLD_VERTEX);
+
+		// Several vertices at one position are a seam
+		vector<int> wedgeCounts(positionCount, 0);
+		for (int v = 0; v < vertexCount; v++)
+		{
+			wedgeCounts[positionIDs[v]]++;
+		}
+
+		vector<int> borderEdges(positionCount, 0);
+		vector<unsigned char> positionKinds(positionCount, MANIFOLD_VERTEX);
+		for (unordered_map<unsigned long long, int>::const_iterator edge = edges.begin(); edge != edges.end(); ++edge)
+		{
+			int a = (int)(edge->first >> 32), b = (int)(edge->first & 0xFFFFFFFF);
+			unordered_map<unsigned long long, int>::const_iterator opposite = edges.find(EdgeKey(b, a));
+			if (edge->second > 1 || (opposite != edges.end() && opposite->second > 1))
+			{
+				positionKinds[a] = positionKinds[b] = LOCKED_VERTEX;
+			}
+			else if (opposite == edges.end())
+			{
+				borderEdges[a]++;
+				borderEdges[b]++;
+			}
+		}
+
+		for (int v = 0; v < vertexCount; v++)
+		{
+			int position = positionIDs[v];
+			if (wedgeCounts[position] > 1 || positionKinds[position] == LOCKED_VERTEX || (borderEdges[position] != 0 && borderEdges[position] != 2))
+			{
+				kinds[v] = LOCKED_VERTEX;
+			}
+			else if (borderEdges[position] == 2)
+			{
+				kinds[v] = BORDER_VERTEX;
+			}
+		}
+	}
+
+	// border tells whether the edge between the two is open
+	static void AddCollapse(unsigned int from, unsigned int to, bool border, const vector<vec3>& positions, const vector<int>& positionIDs, const vector<unsigned char>& kinds, const vector<Quadric>& quadrics, vector<Collapse>& collapses)
+	{
+		// A border vertex can only slide along one of its border edges
+		if (kinds[from] == LOCKED_VERTEX || (kinds[from] == BORDER_VERTEX && !border))
+		{
+			return;
+		}
+
+		Collapse collapse;
+		collapse.from = from;
+		collapse.to = to;
+		collapse.cost = quadrics[positionIDs[from]].Evaluate(positions[to]);
+		collapses.push_back(collapse);
+	}
+
+	// Triangles of each vertex, as offsets into one array
+	static void BuildAdjacency(int vertexCount, const vector<unsigned int>& indices, vector<int>& offsets, vector<int>& adjacency)
+	{
+		offsets.assign(vertexCount + 1, 0);
+		for (size_t i = 0; i < indices.size(); i++)
+		{
+			offsets[indices[i] + 1]++;
+		}
+		for (int v = 0; v < vertexCount; v++)
+		{
+			offsets[v + 1] += offsets[v];
+		}
+
+		adjacency.resize(indices.size());
+		vector<int> filled(offsets.begin(), offsets.end() - 1);
+		for (size_t i = 0; i < indices.size(); i++)
+		{
+			adjacency[filled[indices[i]]++] = (int)(i / 3);
+		}
+	}
+
+	// True when moving from onto to turns a remaining triangle around, or nearly
+	static bool Flips(const Collapse& collapse, const vector<vec3>& positions, const vector<unsigned int>& indices, const vector<int>& offsets, const vector<int>& adjacency)
+	{
+		const vec3& target = positions[collapse.to];
+		for (int t = offsets[collapse.from]; t < offsets[collapse.from + 1]; t++)
+		{
+			const unsigned int* triangle = &indices[adjacency[t] * 3];
+			if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to)
+			{
+				continue; // Removed by the collapse
+			}
+
+			int k = triangle[0] == collapse.from ? 0 : (triangle[1] == collapse.from ? 1 : 2);
+			const vec3& p1 = positions[triangle[(k + 1) % 3]];
+			const vec3& p2 = positions[triangle[(k + 2) % 3]];
+			vec3 before = cross(p1 - positions[collapse.from], p2 - positions[collapse.from]);
+			vec3 after = cross(p1 - target, p2 - target);
+
+			// Rotating by more than about 75 degrees counts too, slivers turned on edge flip with the next collapse
+			if (dot(before, after) <= 0.25f * length(before) * length(after))
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Moves collapsed vertices and drops the triangles that became degenerate
+	static void ApplyRemap(const vector<int>& remap, vector<unsigned int>& indices)
+	{
+		size_t write = 0;
+		for (size_t i = 0; i < indices.size(); i += 3)
+		{
+			unsigned int a = remap[indices[i]], b = remap[indices[i + 1]], c = remap[indices[i + 2]];
+			if (a != b && b != c && a != c)
+			{
+				indices[write++] = a;
+				indices[write++] = b;
+				indices[write++] = c;
+			}
+		}
+		indices.resize(write);
+	}
+};
+
+#endif
@@ -0,0 +1,375 @@
+#ifndef MESHLETS_H
+#define MESHLETS_H
+
+#include "Bounds.h"
+#include "Frustum.h"
+#include "Simd.h"
+
+#include <glm/glm/glm.hpp>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+using namespace std;
+using namespace glm;
+
+// Size limits of a meshlet, the usual mesh shader budget so clusters stay small enough to cull on their own
+const int MESHLET_MAX_VERTICES = 64;
+const int MESHLET_MAX_TRIANGLES = 124;
+
+// Meshes with fewer triangles are culled as a whole
+const int MESHLET_MIN_MESH_TRIANGLES = 4 * MESHLET_MAX_TRIANGLES;
+
+// Range of a mesh's index buffer, in indices
+struct IndexRange
+{
+	int firstIndex;
+	int indexCount;
+};
+
+// Cluster of neighbouring triangles, stored as a contiguous range of its mesh's indices
+struct Meshlet
+{
+	BoundingSphere bounds;
+	vec3 coneAxis;		// Average facing of the triangles
+	float coneCos;		// Every triangle normal is within the cone's half angle of the axis
+	float coneSin;		// A cone of 90 degrees or more is stored as cos 0, sin 1 and never culled
+	IndexRange indices;
+};
+
+// Load time clustering of a mesh's triangles into meshlets
+class MeshletBuilder
+{
+public:
+	// Positions are the first three floats of every vertex, stride is the number of floats per vertex
+	// Reorders the triangles so every meshlet is a contiguous range, the vertices are left as they are
+	static vector<Meshlet> Build(const vector<float>& vertices, int stride, vector<unsigned int>& indices)
+	{
+		int vertexCount = (int)vertices.size() / stride;
+		int triangleCount = (int)indices.size() / 3;
+
+		// Triangles of each vertex, as offsets into one array
+		vector<int> offsets(vertexCount + 1, 0);
+		for (size_t i = 0; i < indices.size(); i++)
+		{
+			offsets[indices[i] + 1]++;
+		}
+		for (int v = 0; v < vertexCount; v++)
+		{
+			offsets[v + 1] += offsets[v];
+		}
+		vector<int> adjacency(indices.size());
+		vector<int> filled(offsets.begin(), offsets.end() - 1);
+		for (size_t i = 0; i < indices.size(); i++)
+		{
+			adjacency[filled[indices[i]]++] = (int)(i / 3);
+		}
+
+		vector<Meshlet> meshlets;
+		vector<unsigned int> ordered;
+		ordered.reserve(indices.size());
+		vector<unsigned char> emitted(triangleCount, 0);
+		vector<int> vertexMeshlet(vertexCount, -1); // Last meshlet each vertex was added to
+		vector<int> meshletVertices;
+		int seed = 0;
+
+		// Meshlets grow from the first triangle left in the mesh's (cache optimized) order
+		// Each step adds the neighbouring triangle bringing the fewest new vertices, nearest the meshlet's center on ties
+		for (;;)
+		{
+			while (seed < triangleCount && emitted[seed])
+			{
+				seed++;
+			}
+			if (seed == triangleCount)
+			{
+				break;
+			}
+
+			int meshletIndex = (int)meshlets.size();
+			int firstIndex = (int)ordered.size();
+			meshletVertices.clear();
+			vec3 positionSum(0.0f);
+
+			for (int triangle = seed; triangle != -1;)
+			{
+				emitted[triangle] = 1;
+				for (int k = 0; k < 3; k++)
+				{
+					unsigned int vertex = indices[triangle * 3 + k];
+					ordered.push_back(vertex);
+					if (vertexMeshlet[vertex] != meshletIndex)
+					{
+						vertexMeshlet[vertex] = meshletIndex;
+						meshletVertices.push_back(vertex);
+						positionSum += Position(vertices, stride, vertex);
+					}
+				}
+				if ((int)(ordered.size() - firstIndex) / 3 == MESHLET_MAX_TRIANGLES)
+				{
+					break;
+				}
+
+				vec3 center = positionSum / (float)meshletVertices.size();
+				triangle = -1;
+				int bestNewVertices = 4;
+				float bestDistance = FLT_MAX;
+				for (int vertex : meshletVertices)
+				{
+					for (int t = offsets[vertex]; t < offsets[vertex + 1]; t++)
+					{
+						int candidate = adjacency[t];
+						if (emitted[candidate])
+						{
+							continue;
+						}
+
+						int newVertices = 0;
+						vec3 centroid(0.0f);
+						for (int k = 0; k < 3; k++)
+						{
+							unsigned int corner = indices[candidate * 3 + k];
+							newVertices += vertexMeshlet[corner] != meshletIndex ? 1 : 0;
+							centroid += Position(vertices, stride, corner);
+						}
+						if ((int)meshletVertices.size() + newVertices > MESHLET_MAX_VERTICES || newVertices > bestNewVertices)
+						{
+							continue;
+						}
+
+						float distance = length(centroid / 3.0f - center);
+						if (newVertices < bestNewVertices || distance < bestDistance)
+						{
+							triangle = candidate;
+							bestNewVertices = newVertices;
+							bestDistance = distance;
+						}
+					}
+				}
+			}
+
+			Meshlet meshlet;
+			meshlet.indices.firstIndex = firstIndex;
+			meshlet.indices.indexCount = (int)ordered.size() - firstIndex;
+			ComputeBounds(vertices, stride, ordered, meshletVertices, meshlet);
+			meshlets.push_back(meshlet);
+		}
+
+		indices.swap(ordered);
+		return meshlets;
+	}
+
+private:
+	static vec3 Position(const vector<float>& vertices, int stride, unsigned int vertex)
+	{
+		return vec3(vertices[vertex * stride], vertices[vertex * stride + 1], vertices[vertex * stride + 2]);
+	}
+
+	// Sphere around the vertices' box center, and the narrowest cone around the average normal holding every triangle normal
+	static void ComputeBounds(const vector<float>& vertices, int stride, const vector<unsigned int>& indices, const vector<int>& meshletVertices, Meshlet& meshlet)
+	{
+		vec3 minimum(FLT_MAX), maximum(-FLT_MAX);
+		for (int vertex : meshletVertices)
+		{
+			vec3 position = Position(vertices, stride, vertex);
+			minimum = min(minimum, position);
+			maximum = max(maximum, position);
+		}
+		meshlet.bounds.center = (minimum + maximum) * 0.5f;
+		meshlet.bounds.radius = 0.0f;
+		for (int vertex : meshletVertices)
+		{
+			meshlet.bounds.radius = std::max(meshlet.bounds.radius, length(Position(vertices, stride, vertex) - meshlet.bounds.center));
+		}
+
+		int firstTriangle = meshlet.indices.firstIndex / 3;
+		int triangleCount = meshlet.indices.indexCount / 3;
+		vector<vec3> normals;
+		normals.reserve(triangleCount);
+		vec3 normalSum(0.0f);
+		for (int triangle = firstTriangle; triangle < firstTriangle + triangleCount; triangle++)
+		{
+			vec3 a = Position(vertices, stride, indices[triangle * 3]);
+			vec3 normal = cross(Position(vertices, stride, indices[triangle * 3 + 1]) - a, Position(vertices, stride, indices[triangle * 3 + 2]) - a);
+			float area = length(normal);
+			if (area > 0.0f)
+			{
+				normals.push_back(normal / area);
+				normalSum += normal / area;
+			}
+		}
+
+		float axisLength = length(normalSum);
+		meshlet.coneAxis = axisLength > 0.0f ? normalSum / axisLength : vec3(0.0f, 0.0f, 1.0f);
+		meshlet.coneCos = axisLength > 0.0f ? 1.0f : 0.0f;
+		for (const vec3& normal : normals)
+		{
+			meshlet.coneCos = std::min(meshlet.coneCos, dot(normal, meshlet.coneAxis));
+		}
+		meshlet.coneCos = std::max(meshlet.coneCos, 0.0f);
+		meshlet.coneSin = sqrt(1.0f - meshlet.coneCos * meshlet.coneCos);
+	}
+};
+
+// Rejects the meshlets of one mesh that are outside the frustum or whose triangles all face away from the camera
+// Meshlets are kept in separate arrays (SoA) and tested four at a time, like FrustumCuller
+// Cull only reads, so entities sharing a mesh can be culled from several threads
+class MeshletCuller
+{
+public:
+	void SetMeshlets(const vector<Meshlet>& meshlets)
+	{
+		ranges.clear();
+		centerX.clear();
+		centerY.clear();
+		centerZ.clear();
+		radius.clear();
+		axisX.clear();
+		axisY.clear();
+		axisZ.clear();
+		coneCos.clear();
+		coneSin.clear();
+		for (const Meshlet& meshlet : meshlets)
+		{
+			ranges.push_back(meshlet.indices);
+			centerX.push_back(meshlet.bounds.center.x);
+			centerY.push_back(meshlet.bounds.center.y);
+			centerZ.push_back(meshlet.bounds.center.z);
+			radius.push_back(meshlet.bounds.radius);
+			axisX.push_back(meshlet.coneAxis.x);
+			axisY.push_back(meshlet.coneAxis.y);
+			axisZ.push_back(meshlet.coneAxis.z);
+			coneCos.push_back(meshlet.coneCos);
+			coneSin.push_back(meshlet.coneSin);
+		}
+	}
+
+	int GetMeshletCount() const
+	{
+		return (int)ranges.size();
+	}
+
+	// Writes the index ranges of the meshlets left, neighbouring survivors merged into one range, and returns their count
+	// The frustum and camera are in world space, modelMatrix places the mesh
+	// Meshlets facing away are only dropped with backFaceCulling, when the pipeline drawing them culls back faces too
+	int Cull(const mat4& modelMatrix, const Frustum& frustum, const vec3& cameraPosition, bool backFaceCulling, vector<IndexRange>& visibleRanges) const
+	{
+		visibleRanges.clear();
+
+		// Planes and camera are moved into the mesh's space rather than every meshlet into the world
+		// Planes transform by the transposed model matrix, renormalized so distances compare to local radii
+		Frustum localFrustum;
+		for (int p = 0; p < 6; p++)
+		{
+			vec4 plane = transpose(modelMatrix) * frustum.planes[p];
+			localFrustum.planes[p] = plane / length(vec3(plane));
+		}
+		vec3 camera = vec3(inverse(modelMatrix) * vec4(cameraPosition, 1.0f));
+
+		int count = GetMeshletCount();
+		int visibleCount = 0;
+		int i = 0;
+
+#ifdef USE_SSE
+		__m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+		for (int p = 0; p < 6; p++)
+		{
+			planeX[p] = _mm_set1_ps(localFrustum.planes[p].x);
+			planeY[p] = _mm_set1_ps(localFrustum.planes[p].y);
+			planeZ[p] = _mm_set1_ps(localFrustum.planes[p].z);
+			planeW[p] = _mm_set1_ps(localFrustum.planes[p].w);
+		}
+		__m128 cameraX = _mm_set1_ps(camera.x), cameraY = _mm_set1_ps(camera.y), cameraZ = _mm_set1_ps(camera.z);
+		__m128 zero = _mm_setzero_ps();
+
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128 x = _mm_loadu_ps(&centerX[i]);
+			__m128 y = _mm_loadu_ps(&centerY[i]);
+			__m128 z = _mm_loadu_ps(&centerZ[i]);
+			__m128 sphereRadius = _mm_loadu_ps(&radius[i]);
+			__m128 negativeRadius = _mm_sub_ps(zero, sphereRadius);
+
+			__m128 visible = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			for (int p = 0; p < 6; p++)
+			{
+				__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX[p], x), _mm_mul_ps(planeY[p], y)),
+											 _mm_add_ps(_mm_mul_ps(planeZ[p], z), planeW[p]));
+				visible = _mm_and_ps(visible, _mm_cmpge_ps(distance, negativeRadius));
+			}
+
+			// Back facing when the angle from the axis to the view direction plus the cone's half angle stays under 90 degrees
+			// by the sphere's margin: dot * cos - sqrt(length^2 - dot^2) * sin > radius
+			__m128 viewX = _mm_sub_ps(x, cameraX), viewY = _mm_sub_ps(y, cameraY), viewZ = _mm_sub_ps(z, cameraZ);
+			__m128 axisDot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(viewX, _mm_loadu_ps(&axisX[i])), _mm_mul_ps(viewY, _mm_loadu_ps(&axisY[i]))),
+										_mm_mul_ps(viewZ, _mm_loadu_ps(&axisZ[i])));
+			__m128 lengthSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(viewX, viewX), _mm_mul_ps(viewY, viewY)), _mm_mul_ps(viewZ, viewZ));
+			__m128 across = _mm_sqrt_ps(_mm_max_ps(_mm_sub_ps(lengthSquared, _mm_mul_ps(axisDot, axisDot)), zero));
+			__m128 facing = _mm_sub_ps(_mm_mul_ps(axisDot, _mm_loadu_ps(&coneCos[i])), _mm_mul_ps(across, _mm_loadu_ps(&coneSin[i])));
+			if (backFaceCulling)
+			{
+				visible = _mm_andnot_ps(_mm_cmpgt_ps(facing, sphereRadius), visible);
+			}
+
+			int mask = _mm_movemask_ps(visible);
+			for (int lane = 0; lane < 4; lane++)
+			{
+				if (mask & (1 << lane))
+				{
+					AddRange(ranges[i + lane], visibleRanges);
+					visibleCount++;
+				}
+			}
+		}
+#endif
+
+		// Remaining meshlets (or all of them without SSE)
+		for (; i < count; i++)
+		{
+			vec3 center(centerX[i], centerY[i], centerZ[i]);
+			if (!localFrustum.IsVisible(center, radius[i]))
+			{
+				continue;
+			}
+
+			vec3 view = center - camera;
+			float axisDot = dot(view, vec3(axisX[i], axisY[i], axisZ[i]));
+			float across = sqrt(std::max(dot(view, view) - axisDot * axisDot, 0.0f));
+			if (backFaceCulling && axisDot * coneCos[i] - across * coneSin[i] > radius[i])
+			{
+				continue;
+			}
+
+			AddRange(ranges[i], visibleRanges);
+			visibleCount++;
+		}
+
+		return visibleCount;
+	}
+
+private:
+	vector<IndexRange> ranges;
+	vector<float> centerX;
+	vector<float> centerY;
+	vector<float> centerZ;
+	vector<float> radius;
+	vector<float> axisX;
+	vector<float> axisY;
+	vector<float> axisZ;
+	vector<float> coneCos;
+	vector<float> coneSin;
+
+	// Meshlets are stored back to back, so consecutive survivors extend the previous range
+	static void AddRange(const IndexRange& range, vector<IndexRange>& visibleRanges)
+	{
+		if (!visibleRanges.empty() && visibleRanges.back().firstIndex + visibleRanges.back().indexCount == range.firstIndex)
+		{
+			visibleRanges.back().indexCount += range.indexCount;
+			return;
+		}
+		visibleRanges.push_back(range);
+	}
+};
+
+#endif
@@ -1,6 +1,16 @@
 #ifndef OBJECT_H
 #define OBJECT_H
 
+#include "Bounds.h"
+#include "GLState.h"
+#include "InstanceBuffer.h"
+#include "JobSystem.h"
+#include "MeshArena.h"
+#include "MeshBuilder.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "Meshlets.h"
+#include "VertexLayout.h"
 #include "stb_image.h"
 
 #include <glad\glad.h>
@@ -16,96 +26,322 @@ using namespace std;
 class Object
 {
 public:
-	Object(vector<float> vertices, vector<unsigned int> indices, string texturePath)
+	// format tells which attributes each float vertex holds and how they are stored on the GPU
+	// Quantized meshes store compressed vertices, their model matrices must be multiplied by GetPositionDecodeMatrix()
+	// lodCount levels of detail are generated, each with about half the triangles of the previous one
+	Object(vector<float> vertices, vector<unsigned int> indices, string texturePath, VertexFormat format = VertexFormat(), int lodCount = 1)
 	{
-		triangleCount = vertices.size() / 5;
+		id = NextID()++;
+		int stride = VertexLayout::SourceStride(format.attributes);
+		vertexStride = stride;
 
-		// Vertices
-		this->vertices = new float[vertices.size()];
-		for (int i = 0; i < vertices.size(); i++)
+		// The image decodes on a worker while the mesh is processed here
+		TextureImage image;
+		JobCounter imageLoaded;
+		stbi_set_flip_vertically_on_load(true);
+		JobSystem::Spawn([&image, &texturePath]() { image.Load(texturePath); }, &imageLoaded, LOW_PRIORITY);
+
+		// Vertices and Indices
+		// Meshes given without indices have their duplicated vertices welded into an index buffer
+		if (indices.empty())
 		{
-			this->vertices[i] = vertices[i];
+			MeshBuilder::Weld(vertices, stride, this->vertices, this->indices);
 		}
+		else
+		{
+			this->vertices = vertices;
+			this->indices = indices;
+		}
+
+		// Reorders triangles and vertices for the post-transform cache, overdraw and vertex fetch
+		optimizationStats = MeshOptimizer::Optimize(this->vertices, stride, this->indices);
+
+		vertexCount = this->vertices.size() / stride;
+		indexCount = this->indices.size();
 
-		// Indices
-		this->indices = new unsigned int[indices.size()];
-		for (int i = 0; i < indices.size(); i++)
+		// Bounds
+		bounds = AABB::FromVertices(this->vertices.data(), vertexCount, stride);
+		boundingSphere = BoundingSphere::FromAABB(bounds);
+
+		// Simplified index buffers over the same vertices
+		vector<vector<unsigned int> > lodIndices;
+		GenerateLods(lodCount, lodIndices);
+
+		// Large meshes have their triangles regrouped into meshlets, which level 0 draws can cull one by one
+		if (this->indices.size() / 3 >= MESHLET_MIN_MESH_TRIANGLES)
 		{
-			this->indices[i] = indices[i];
+			meshletCuller.SetMeshlets(MeshletBuilder::Build(this->vertices, stride, this->indices));
 		}
 
-		GenerateVAO();
-		GenerateVBO();
-		GenerateEBO();
-		DefineVertexData();
-		GenerateTexture(texturePath);
+		// GPU vertex format
+		VertexEncoder::Encode(this->vertices, format, encodedStreams, layout, positionDecode);
+
+		Upload(lodIndices);
+		JobSystem::Wait(imageLoaded);
+		GenerateTexture(image);
 		Unbind();
 	}
 
-	void Draw()
+	~Object()
 	{
+		for (const MeshAllocation& lod : lods)
+		{
+			arena->Free(lod);
+		}
+	}
+
+	// Owns its arena range
+	Object(const Object&) = delete;
+	Object& operator=(const Object&) = delete;
+
+	// With an occlusion query the GPU skips the draw when the query saw no samples
+	// GL_QUERY_NO_WAIT draws anyway while the result is not ready, so this never stalls
+	void Draw(unsigned int occlusionQuery = 0, int lod = 0)
+	{
+		const MeshAllocation& allocation = lods[lod];
 		Bind();
-		glDrawArrays(GL_TRIANGLES, 0, triangleCount);
-		Unbind();
+		if (occlusionQuery != 0)
+		{
+			glBeginConditionalRender(occlusionQuery, GL_QUERY_NO_WAIT);
+		}
+		glDrawElementsBaseVertex(GL_TRIANGLES, allocation.indexCount, allocation.indexType, (void*)(size_t)allocation.indexOffset, allocation.baseVertex);
+		if (occlusionQuery != 0)
+		{
+			glEndConditionalRender();
+		}
 	}
-private:
-	unsigned int VAO;
-	unsigned int VBO;
-	unsigned int EBO;
 
-	float* vertices;
-	unsigned int* indices;
-	unsigned int texture;
+	// Draws index ranges of level 0 in one call, like the meshlets left after culling
+	void DrawRanges(const IndexRange* ranges, int rangeCount, unsigned int occlusionQuery = 0)
+	{
+		const MeshAllocation& allocation = lods[0];
+		int indexSize = MeshBuilder::IndexSize(allocation.indexType);
+		rangeCounts.resize(rangeCount);
+		rangeOffsets.resize(rangeCount);
+		rangeBaseVertices.assign(rangeCount, allocation.baseVertex);
+		for (int i = 0; i < rangeCount; i++)
+		{
+			rangeCounts[i] = ranges[i].indexCount;
+			rangeOffsets[i] = (const void*)(size_t)(allocation.indexOffset + ranges[i].firstIndex * indexSize);
+		}
+
+		Bind();
+		if (occlusionQuery != 0)
+		{
+			glBeginConditionalRender(occlusionQuery, GL_QUERY_NO_WAIT);
+		}
+		glMultiDrawElementsBaseVertex(GL_TRIANGLES, rangeCounts.data(), allocation.indexType, rangeOffsets.data(), rangeCount, rangeBaseVertices.data());
+		if (occlusionQuery != 0)
+		{
+			glEndConditionalRender();
+		}
+	}
 
-	int triangleCount;
+	// Draws instanceCount copies, each with its model matrix from the attached instance buffer
+	void DrawInstanced(int instanceCount, int lod = 0)
+	{
+		const MeshAllocation& allocation = lods[lod];
+		Bind();
+		glDrawElementsInstancedBaseVertex(GL_TRIANGLES, allocation.indexCount, allocation.indexType, (void*)(size_t)allocation.indexOffset, instanceCount, allocation.baseVertex);
+	}
 
-	void Bind()
+	// Per-instance model matrices -> layout (location = 2) to (location = 5)
+	// The VAO belongs to the arena, so the instance buffer is shared by every Object with the same vertex layout
+	void SetInstanceBuffer(InstanceBuffer& instanceBuffer)
 	{
-		glBindVertexArray(VAO);
+		arena->SetInstanceBuffer(instanceBuffer);
 	}
 
-	void Unbind()
+	// Local space bounds
+	const AABB& GetBounds()
 	{
-		glBindVertexArray(0);
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		return bounds;
 	}
 
-	void GenerateVAO()
+	const BoundingSphere& GetBoundingSphere()
 	{
-		glGenVertexArrays(1, &VAO);
-		Bind();
+		return boundingSphere;
+	}
+
+	// Maps quantized positions back to the mesh extents, identity for float meshes
+	const mat4& GetPositionDecodeMatrix()
+	{
+		return positionDecode;
+	}
+
+	// Unique per Object, used in render queue sort keys
+	unsigned int GetID()
+	{
+		return id;
+	}
+
+	MeshArena& GetArena()
+	{
+		return *arena;
+	}
+
+	unsigned int GetTexture()
+	{
+		return texture;
+	}
+
+	// Base vertex and index range inside the arena buffers, every level shares the vertices of level 0
+	const MeshAllocation& GetAllocation(int lod = 0)
+	{
+		return lods[lod];
 	}
 
-	void GenerateVBO()
+	// Levels actually generated, simplification stops early once a mesh no longer gets smaller
+	int GetLodCount()
 	{
-		glGenBuffers(1, &VBO);
-		glBindBuffer(GL_ARRAY_BUFFER, VBO);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+		return (int)lods.size();
 	}
 
-	void GenerateEBO()
+	// Meshlets of level 0, none for meshes too small to split
+	const MeshletCuller& GetMeshletCuller()
 	{
-		glGenBuffers(1, &EBO);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+		return meshletCuller;
 	}
 
-	void DefineVertexData()
+	// Float vertices as given (after welding and optimization), positions first, kept for CPU work like occlusion culling
+	// GetIndices() is level 0
+	const vector<float>& GetVertices()
 	{
-		// Vertex Position
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
-		glEnableVertexAttribArray(0);
+		return vertices;
+	}
+
+	const vector<unsigned int>& GetIndices()
+	{
+		return indices;
+	}
+
+	// Floats per vertex in GetVertices()
+	int GetVertexStride()
+	{
+		return vertexStride;
+	}
+
+	// Vertex cache efficiency before and after the mesh was optimized
+	const MeshOptimizationStats& GetOptimizationStats()
+	{
+		return optimizationStats;
+	}
+private:
+	// Decoded pixels, freed with the struct
+	struct TextureImage
+	{
+		unsigned char* data;
+		int width;
+		int height;
+		int colorChannels;
+
+		TextureImage()
+		{
+			data = NULL;
+		}
+
+		~TextureImage()
+		{
+			stbi_image_free(data);
+		}
+
+		void Load(const string& path)
+		{
+			data = stbi_load(path.c_str(), &width, &height, &colorChannels, 0);
+		}
+	};
+
+	unsigned int id;
+	MeshArena* arena;
+	vector<MeshAllocation> lods; // Level 0 owns the vertices
+
+	vector<float> vertices;
+	vector<unsigned int> indices;
+	unsigned int texture;
+
+	vector<vector<unsigned char> > encodedStreams;
+	VertexLayout layout;
+	mat4 positionDecode;
+
+	int vertexCount;
+	int indexCount;
+	int vertexStride;
+
+	AABB bounds;
+	BoundingSphere boundingSphere;
+	MeshOptimizationStats optimizationStats;
+	MeshletCuller meshletCuller;
 
-		// UV Coordinates
-		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
-		glEnableVertexAttribArray(1);
+	// DrawRanges arguments, kept to avoid allocating per draw
+	vector<GLsizei> rangeCounts;
+	vector<const void*> rangeOffsets;
+	vector<GLint> rangeBaseVertices;
+
+	static unsigned int& NextID()
+	{
+		static unsigned int nextID = 0;
+		return nextID;
+	}
+
+	void Bind()
+	{
+		arena->Bind();
+
+		GLState::ActiveTexture(0);
+		GLState::BindTexture(GL_TEXTURE_2D, texture);
 	}
 
-	void GenerateTexture(string path)
+	void Unbind()
+	{
+		MeshArena::Unbind();
+		GLState::BindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	// Each level is simplified from the previous one, allowing twice its error
+	// Stops once a level would keep more than 80% of the previous triangles, usually a mesh made of seams and borders
+	void GenerateLods(int lodCount, vector<vector<unsigned int> >& lodIndices)
+	{
+		const vector<unsigned int>* previous = &indices;
+		float maxError = boundingSphere.radius * 0.01f;
+		for (int lod = 1; lod < lodCount; lod++)
+		{
+			float error;
+			vector<unsigned int> simplified = MeshSimplifier::Simplify(vertices, vertexStride, *previous, previous->size() / 6 * 3, maxError, error);
+			if (simplified.size() > previous->size() * 4 / 5)
+			{
+				break;
+			}
+
+			MeshOptimizer::OptimizeVertexCache(simplified, vertexCount);
+			lodIndices.push_back(simplified);
+			previous = &lodIndices.back();
+			maxError *= 2.0f;
+		}
+	}
+
+	// Copies the mesh into the shared buffers of the arena matching its layout
+	void Upload(const vector<vector<unsigned int> >& lodIndices)
+	{
+		// 16 bit indices whenever the vertex count allows it
+		vector<unsigned char> indexData;
+		GLenum indexType = MeshBuilder::PackIndices(indices, vertexCount, indexData);
+
+		arena = &MeshArena::ForLayout(layout);
+		lods.push_back(arena->Allocate(encodedStreams, vertexCount, indexData, indexType));
+		encodedStreams.clear();
+
+		for (const vector<unsigned int>& levelIndices : lodIndices)
+		{
+			indexType = MeshBuilder::PackIndices(levelIndices, vertexCount, indexData);
+			lods.push_back(arena->AllocateIndices(indexData, indexType, lods[0].baseVertex));
+		}
+	}
+
+	void GenerateTexture(const TextureImage& image)
 	{
 		glGenTextures(1, &texture);
-		glBindTexture(GL_TEXTURE_2D, texture);
+		GLState::ActiveTexture(0);
+		GLState::BindTexture(GL_TEXTURE_2D, texture);
 
 		// Texture Parameters
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -113,23 +349,15 @@ private:
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-		// Load Image
-		stbi_set_flip_vertically_on_load(true);
-
-		int width, height, colorChannels;
-		unsigned char *data = stbi_load(path.c_str(), &width, &height, &colorChannels, 0);
-		if (data)
+		if (image.data)
 		{
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, image.width, image.height, 0, GL_RGB, GL_UNSIGNED_BYTE, image.data);
 			glGenerateMipmap(GL_TEXTURE_2D);
 		}
 		else
 		{
 			cout << "Failed to load texture" << endl;
 		}
-		stbi_image_free(data);
-
-		glActiveTexture(GL_TEXTURE0);
 	}
 };
 
@@ -0,0 +1,284 @@
+#ifndef OCCLUSION_CULLER_H
+#define OCCLUSION_CULLER_H
+
+#include "Bounds.h"
+#include "JobSystem.h"
+#include "Simd.h"
+
+#include <glm/glm/glm.hpp>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+using namespace std;
+using namespace glm;
+
+// Software occlusion culling, no GPU involved
+// Occluder triangles are rasterized into a small depth buffer, split in horizontal bands that workers fill in parallel
+// Objects are then tested with their screen rectangle and nearest depth against that buffer
+// Depth is stored as 1 / w, which interpolates linearly in screen space, larger is nearer, 0 is empty
+class OcclusionCuller
+{
+public:
+	static const int WIDTH = 256;
+	static const int HEIGHT = 128;
+	static const int BAND_HEIGHT = 8; // Rows rasterized by one job
+
+	OcclusionCuller() : depth(WIDTH * HEIGHT, 0.0f), bands(HEIGHT / BAND_HEIGHT)
+	{
+	}
+
+	// Starts a frame, clears the occluders and the depth buffer
+	void Begin(const mat4& viewProjection)
+	{
+		this->viewProjection = viewProjection;
+		triangles.clear();
+		for (vector<int>& band : bands)
+		{
+			band.clear();
+		}
+		fill(depth.begin(), depth.end(), 0.0f);
+	}
+
+	// Positions are the first three floats of every vertex, like AABB::FromVertices
+	// Triangles crossing the near plane are dropped, which only makes the occluder smaller
+	void AddOccluder(const float* vertices, int vertexCount, int stride, const unsigned int* indices, int indexCount, const mat4& model)
+	{
+		mat4 modelViewProjection = viewProjection * model;
+		screenVertices.resize(vertexCount);
+		for (int i = 0; i < vertexCount; i++)
+		{
+			vec4 clip = modelViewProjection * vec4(vertices[i * stride], vertices[i * stride + 1], vertices[i * stride + 2], 1.0f);
+			screenVertices[i] = ToScreen(clip);
+		}
+
+		for (int i = 0; i + 2 < indexCount; i += 3)
+		{
+			const vec3& a = screenVertices[indices[i]];
+			const vec3& b = screenVertices[indices[i + 1]];
+			const vec3& c = screenVertices[indices[i + 2]];
+			if (a.z <= 0.0f || b.z <= 0.0f || c.z <= 0.0f)
+			{
+				continue;
+			}
+
+			// Both windings are kept, occluders are not required to be closed
+			float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+			if (area == 0.0f)
+			{
+				continue;
+			}
+
+			Triangle triangle;
+			triangle.vertices[0] = a;
+			triangle.vertices[1] = area > 0.0f ? b : c;
+			triangle.vertices[2] = area > 0.0f ? c : b;
+
+			float minY = std::min(a.y, std::min(b.y, c.y));
+			float maxY = std::max(a.y, std::max(b.y, c.y));
+			float minX = std::min(a.x, std::min(b.x, c.x));
+			float maxX = std::max(a.x, std::max(b.x, c.x));
+			if (maxY < 0.0f || minY > HEIGHT || maxX < 0.0f || minX > WIDTH)
+			{
+				continue;
+			}
+
+			// Binned to every band its rows touch
+			int index = (int)triangles.size();
+			triangles.push_back(triangle);
+			int firstBand = std::max(0, (int)minY / BAND_HEIGHT);
+			int lastBand = std::min((int)bands.size() - 1, (int)maxY / BAND_HEIGHT);
+			for (int band = firstBand; band <= lastBand; band++)
+			{
+				bands[band].push_back(index);
+			}
+		}
+	}
+
+	// Fills the depth buffer from every occluder added since Begin
+	void Rasterize()
+	{
+		JobSystem::ParallelFor((int)bands.size(), 1, [this](int begin, int end)
+		{
+			for (int band = begin; band < end; band++)
+			{
+				for (int triangle : bands[band])
+				{
+					RasterizeTriangle(triangles[triangle], band * BAND_HEIGHT, (band + 1) * BAND_HEIGHT);
+				}
+			}
+		});
+	}
+
+	// True when every pixel the box covers already holds a nearer occluder
+	// Boxes crossing the near plane or leaving the screen count as visible, safe to call from several threads
+	bool IsOccluded(const AABB& bounds) const
+	{
+		float minX = FLT_MAX, minY = FLT_MAX;
+		float maxX = -FLT_MAX, maxY = -FLT_MAX;
+		float nearest = 0.0f;
+		for (int corner = 0; corner < 8; corner++)
+		{
+			vec3 position((corner & 1) ? bounds.max.x : bounds.min.x, (corner & 2) ? bounds.max.y : bounds.min.y, (corner & 4) ? bounds.max.z : bounds.min.z);
+			vec3 screen = ToScreen(viewProjection * vec4(position, 1.0f));
+			if (screen.z <= 0.0f)
+			{
+				return false;
+			}
+
+			minX = std::min(minX, screen.x);
+			maxX = std::max(maxX, screen.x);
+			minY = std::min(minY, screen.y);
+			maxY = std::max(maxY, screen.y);
+			nearest = std::max(nearest, screen.z);
+		}
+
+		// Every pixel whose center the rectangle covers
+		int firstX = (int)ceil(minX - 0.5f), lastX = (int)floor(maxX - 0.5f);
+		int firstY = (int)ceil(minY - 0.5f), lastY = (int)floor(maxY - 0.5f);
+		if (firstX < 0 || firstY < 0 || lastX >= WIDTH || lastY >= HEIGHT || firstX > lastX || firstY > lastY)
+		{
+			return false;
+		}
+
+		for (int y = firstY; y <= lastY; y++)
+		{
+			const float* row = &depth[y * WIDTH];
+			int x = firstX;
+#ifdef USE_SSE
+			__m128 objectDepth = _mm_set1_ps(nearest);
+			for (; x + 4 <= lastX + 1; x += 4)
+			{
+				if (_mm_movemask_ps(_mm_cmple_ps(_mm_loadu_ps(row + x), objectDepth)) != 0)
+				{
+					return false;
+				}
+			}
+#endif
+			for (; x <= lastX; x++)
+			{
+				if (row[x] <= nearest)
+				{
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	int GetOccluderTriangleCount() const
+	{
+		return (int)triangles.size();
+	}
+
+	// Row major from the bottom row up, 1 / w per pixel
+	const float* GetDepthBuffer() const
+	{
+		return depth.data();
+	}
+
+private:
+	// Screen space, x and y in pixels and z holding 1 / w
+	struct Triangle
+	{
+		vec3 vertices[3]; // Counter clockwise
+	};
+
+	mat4 viewProjection;
+	vector<float> depth;
+	vector<Triangle> triangles;
+	vector<vector<int>> bands; // Triangles touching each band
+	vector<vec3> screenVertices;
+
+	// z is 0 for points behind the eye
+	static vec3 ToScreen(const vec4& clip)
+	{
+		if (clip.w <= 1e-5f)
+		{
+			return vec3(0.0f);
+		}
+
+		float inverseW = 1.0f / clip.w;
+		return vec3((clip.x * inverseW * 0.5f + 0.5f) * WIDTH, (clip.y * inverseW * 0.5f + 0.5f) * HEIGHT, inverseW);
+	}
+
+	// Pixel centers inside the triangle get the nearer of their depth and the triangle's
+	// Four pixels of a row at a time, edge functions and depth are planes stepped along x
+	void RasterizeTriangle(const Triangle& triangle, int bandBegin, int bandEnd)
+	{
+		const vec3& a = triangle.vertices[0];
+		const vec3& b = triangle.vertices[1];
+		const vec3& c = triangle.vertices[2];
+
+		int firstX = std::max(0, (int)ceil(std::min(a.x, std::min(b.x, c.x)) - 0.5f));
+		int lastX = std::min(WIDTH - 1, (int)floor(std::max(a.x, std::max(b.x, c.x)) - 0.5f));
+		int firstY = std::max(bandBegin, (int)ceil(std::min(a.y, std::min(b.y, c.y)) - 0.5f));
+		int lastY = std::min(bandEnd - 1, (int)floor(std::max(a.y, std::max(b.y, c.y)) - 0.5f));
+		if (firstX > lastX || firstY > lastY)
+		{
+			return;
+		}
+
+		// Edge i is positive on the inside: stepX * x + stepY * y + offset
+		vec3 edgeStepX(b.y - c.y, c.y - a.y, a.y - b.y);
+		vec3 edgeStepY(c.x - b.x, a.x - c.x, b.x - a.x);
+		vec3 edgeOffset(b.x * c.y - c.x * b.y, c.x * a.y - a.x * c.y, a.x * b.y - b.x * a.y);
+		float area = edgeOffset.x + edgeOffset.y + edgeOffset.z;
+
+		// Depth plane from the barycentric weights
+		float depthStepX = dot(edgeStepX, vec3(a.z, b.z, c.z)) / area;
+		float depthStepY = dot(edgeStepY, vec3(a.z, b.z, c.z)) / area;
+		float depthOffset = dot(edgeOffset, vec3(a.z, b.z, c.z)) / area;
+
+		for (int y = firstY; y <= lastY; y++)
+		{
+			float centerY = y + 0.5f;
+			float* row = &depth[y * WIDTH];
+			int x = firstX;
+
+#ifdef USE_SSE
+			__m128 laneOffsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+			__m128 stepX0 = _mm_set1_ps(edgeStepX.x), stepX1 = _mm_set1_ps(edgeStepX.y), stepX2 = _mm_set1_ps(edgeStepX.z);
+			__m128 rowEdge0 = _mm_set1_ps(edgeStepY.x * centerY + edgeOffset.x);
+			__m128 rowEdge1 = _mm_set1_ps(edgeStepY.y * centerY + edgeOffset.y);
+			__m128 rowEdge2 = _mm_set1_ps(edgeStepY.z * centerY + edgeOffset.z);
+			__m128 depthX = _mm_set1_ps(depthStepX);
+			__m128 rowDepth = _mm_set1_ps(depthStepY * centerY + depthOffset);
+			__m128 zero = _mm_setzero_ps();
+
+			for (; x + 4 <= lastX + 1; x += 4)
+			{
+				__m128 centerX = _mm_add_ps(_mm_set1_ps((float)x), laneOffsets);
+				__m128 edge0 = _mm_add_ps(_mm_mul_ps(stepX0, centerX), rowEdge0);
+				__m128 edge1 = _mm_add_ps(_mm_mul_ps(stepX1, centerX), rowEdge1);
+				__m128 edge2 = _mm_add_ps(_mm_mul_ps(stepX2, centerX), rowEdge2);
+				__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(edge0, zero), _mm_cmpge_ps(edge1, zero)), _mm_cmpge_ps(edge2, zero));
+				if (_mm_movemask_ps(inside) == 0)
+				{
+					continue;
+				}
+
+				__m128 pixelDepth = _mm_add_ps(_mm_mul_ps(depthX, centerX), rowDepth);
+				__m128 current = _mm_loadu_ps(row + x);
+				__m128 nearer = _mm_max_ps(current, pixelDepth);
+				_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, current)));
+			}
+#endif
+
+			// Remaining pixels of the row (or all of them without SSE)
+			for (; x <= lastX; x++)
+			{
+				float centerX = x + 0.5f;
+				if (edgeStepX.x * centerX + edgeStepY.x * centerY + edgeOffset.x >= 0.0f &&
+					edgeStepX.y * centerX + edgeStepY.y * centerY + edgeOffset.y >= 0.0f &&
+					edgeStepX.z * centerX + edgeStepY.z * centerY + edgeOffset.z >= 0.0f)
+				{
+					row[x] = std::max(row[x], depthStepX * centerX + depthStepY * centerY + depthOffset);
+				}
+			}
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,131 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+enum RenderPass
+{
+	OPAQUE_PASS = 0,
+	TRANSPARENT_PASS = 1
+};
+
+// A draw in the queue, index refers to the caller's own draw data
+struct RenderItem
+{
+	uint64_t key;
+	uint32_t index;
+};
+
+// Draws packed into 64 bit sort keys, most significant bits first:
+//   Opaque:      pass (2) | shader (10) | arena (4) | texture (12) | mesh (12) | depth (24)
+//   Transparent: pass (2) | inverted depth (24) | shader (10) | arena (4) | texture (12) | mesh (12)
+// Sorting the keys groups opaque draws by state so program, VAO and texture changes happen once per group, nearest first
+// inside a group for early-Z. Transparent draws are ordered back to front, as blending needs
+class RenderQueue
+{
+public:
+	void Clear()
+	{
+		items.clear();
+	}
+
+	void Submit(uint64_t key, uint32_t index)
+	{
+		RenderItem item;
+		item.key = key;
+		item.index = index;
+		items.push_back(item);
+	}
+
+	// depth is the normalized view distance in [0, 1]
+	static uint64_t MakeOpaqueKey(unsigned int shader, unsigned int arena, unsigned int texture, unsigned int mesh, float depth)
+	{
+		return ((uint64_t)OPAQUE_PASS << 62) | (StateBits(shader, arena, texture, mesh) << 24) | QuantizeDepth(depth);
+	}
+
+	static uint64_t MakeTransparentKey(unsigned int shader, unsigned int arena, unsigned int texture, unsigned int mesh, float depth)
+	{
+		uint64_t invertedDepth = 0xFFFFFF - QuantizeDepth(depth);
+		return ((uint64_t)TRANSPARENT_PASS << 62) | (invertedDepth << 38) | StateBits(shader, arena, texture, mesh);
+	}
+
+	// LSD radix sort, one pass per key byte, stable
+	// Bytes that are equal in every key (unused shader bits, a single pass...) are skipped
+	void Sort()
+	{
+		size_t count = items.size();
+		if (count < 2)
+		{
+			return;
+		}
+		scratch.resize(count);
+
+		// Histograms of all eight bytes in a single read of the keys
+		uint32_t histograms[8][256] = {};
+		for (size_t i = 0; i < count; i++)
+		{
+			uint64_t key = items[i].key;
+			for (int pass = 0; pass < 8; pass++)
+			{
+				histograms[pass][(key >> (pass * 8)) & 0xFF]++;
+			}
+		}
+
+		RenderItem* source = items.data();
+		RenderItem* destination = scratch.data();
+		for (int pass = 0; pass < 8; pass++)
+		{
+			uint32_t* histogram = histograms[pass];
+			int shift = pass * 8;
+			if (histogram[(source[0].key >> shift) & 0xFF] == count)
+			{
+				continue;
+			}
+
+			// Bucket start offsets
+			uint32_t offset = 0;
+			for (int bucket = 0; bucket < 256; bucket++)
+			{
+				uint32_t bucketCount = histogram[bucket];
+				histogram[bucket] = offset;
+				offset += bucketCount;
+			}
+
+			for (size_t i = 0; i < count; i++)
+			{
+				destination[histogram[(source[i].key >> shift) & 0xFF]++] = source[i];
+			}
+			swap(source, destination);
+		}
+
+		if (source != items.data())
+		{
+			items.swap(scratch);
+		}
+	}
+
+	const vector<RenderItem>& GetItems()
+	{
+		return items;
+	}
+
+private:
+	vector<RenderItem> items;
+	vector<RenderItem> scratch;
+
+	static uint64_t StateBits(unsigned int shader, unsigned int arena, unsigned int texture, unsigned int mesh)
+	{
+		return ((uint64_t)(shader & 0x3FF) << 28) | ((uint64_t)(arena & 0xF) << 24) | ((uint64_t)(texture & 0xFFF) << 12) | (mesh & 0xFFF);
+	}
+
+	static uint64_t QuantizeDepth(float depth)
+	{
+		depth = depth < 0.0f ? 0.0f : (depth > 1.0f ? 1.0f : depth);
+		return (uint64_t)(depth * 16777215.0f);
+	}
+};
+
+#endif
@@ -0,0 +1,179 @@
+#ifndef SCENE_GRAPH_H
+#define SCENE_GRAPH_H
+
+#include <glm/glm/glm.hpp>
+#include <algorithm>
+#include <vector>
+
+using namespace std;
+using namespace glm;
+
+// Transform hierarchy kept in flat arrays sorted by depth, so every parent comes before its children
+// Update is one linear pass: a node is dirty when it changed or its parent was, only dirty nodes are recomputed
+// Nodes are referred to by handles, which stay valid when the arrays are re-sorted
+class SceneGraph
+{
+public:
+	SceneGraph()
+	{
+		sorted = true;
+		firstDirty = 0;
+	}
+
+	// parent is a handle, or -1 for a root
+	int CreateNode(int parent = -1, const mat4& localMatrix = mat4(1.0f))
+	{
+		int handle = (int)handleToIndex.size();
+		int index = (int)parents.size();
+		int depth = parent == -1 ? 0 : depths[handleToIndex[parent]] + 1;
+
+		// Appending keeps the order as long as depths do not decrease
+		if (index > 0 && depth < depths[index - 1])
+		{
+			sorted = false;
+		}
+
+		handleToIndex.push_back(index);
+		indexToHandle.push_back(handle);
+		parents.push_back(parent == -1 ? -1 : handleToIndex[parent]);
+		depths.push_back(depth);
+		localMatrices.push_back(localMatrix);
+		worldMatrices.push_back(localMatrix);
+		dirty.push_back(1);
+		firstDirty = std::min(firstDirty, index);
+		return handle;
+	}
+
+	void SetLocalMatrix(int handle, const mat4& localMatrix)
+	{
+		int index = handleToIndex[handle];
+		localMatrices[index] = localMatrix;
+		dirty[index] = 1;
+		firstDirty = std::min(firstDirty, index);
+	}
+
+	const mat4& GetLocalMatrix(int handle) const
+	{
+		return localMatrices[handleToIndex[handle]];
+	}
+
+	// Valid after Update
+	const mat4& GetWorldMatrix(int handle) const
+	{
+		return worldMatrices[handleToIndex[handle]];
+	}
+
+	// Recomputes the world matrices of changed nodes and everything below them
+	void Update()
+	{
+		if (!sorted)
+		{
+			SortByDepth();
+		}
+
+		updatedNodes.clear();
+		int count = (int)parents.size();
+
+		// Nodes before the first dirty one cannot be affected, their parents come even earlier
+		for (int i = firstDirty; i < count; i++)
+		{
+			int parent = parents[i];
+			if (parent != -1)
+			{
+				dirty[i] |= dirty[parent];
+			}
+			if (!dirty[i])
+			{
+				continue;
+			}
+
+			worldMatrices[i] = parent == -1 ? localMatrices[i] : worldMatrices[parent] * localMatrices[i];
+			updatedNodes.push_back(indexToHandle[i]);
+		}
+
+		// Cleared afterwards, children read their parent's flag during the pass
+		if (firstDirty < count)
+		{
+			fill(dirty.begin() + firstDirty, dirty.end(), (unsigned char)0);
+		}
+		firstDirty = count;
+	}
+
+	int GetNodeCount() const
+	{
+		return (int)parents.size();
+	}
+
+	// World matrices recomputed by the last Update
+	int GetUpdatedCount() const
+	{
+		return (int)updatedNodes.size();
+	}
+
+	// Handles of the nodes whose world matrix the last Update recomputed
+	const vector<int>& GetUpdatedNodes() const
+	{
+		return updatedNodes;
+	}
+
+private:
+	// Indexed by position in the sorted arrays
+	vector<int> parents; // Index of the parent, -1 for roots
+	vector<int> depths;
+	vector<mat4> localMatrices;
+	vector<mat4> worldMatrices;
+	vector<unsigned char> dirty;
+	vector<int> indexToHandle;
+
+	vector<int> handleToIndex;
+
+	bool sorted;
+	int firstDirty; // Lowest index that may be dirty
+	vector<int> updatedNodes;
+
+	// Stable, so siblings keep their creation order
+	void SortByDepth()
+	{
+		int count = (int)parents.size();
+		vector<int> order(count);
+		for (int i = 0; i < count; i++)
+		{
+			order[i] = i;
+		}
+		stable_sort(order.begin(), order.end(), [this](int a, int b) { return depths[a] < depths[b]; });
+
+		vector<int> newIndex(count);
+		for (int i = 0; i < count; i++)
+		{
+			newIndex[order[i]] = i;
+		}
+
+		vector<int> sortedParents(count), sortedDepths(count), sortedHandles(count);
+		vector<mat4> sortedLocal(count), sortedWorld(count);
+		vector<unsigned char> sortedDirty(count);
+		for (int i = 0; i < count; i++)
+		{
+			int old = order[i];
+			sortedParents[i] = parents[old] == -1 ? -1 : newIndex[parents[old]];
+			sortedDepths[i] = depths[old];
+			sortedHandles[i] = indexToHandle[old];
+			sortedLocal[i] = localMatrices[old];
+			sortedWorld[i] = worldMatrices[old];
+			sortedDirty[i] = dirty[old];
+			handleToIndex[indexToHandle[old]] = i;
+		}
+
+		parents.swap(sortedParents);
+		depths.swap(sortedDepths);
+		indexToHandle.swap(sortedHandles);
+		localMatrices.swap(sortedLocal);
+		worldMatrices.swap(sortedWorld);
+		dirty.swap(sortedDirty);
+
+		// Any dirty node may have moved in front of the old first dirty index
+		firstDirty = 0;
+		sorted = true;
+	}
+};
+
+#endif
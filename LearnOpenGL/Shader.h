@@ -1,6 +1,9 @@
 #ifndef SHADER_H
 #define SHADER_H
 
+#include "GLState.h"
+#include "UniformBuffer.h"
+
 #include <glad/glad.h>
 #include <glm/glm/glm.hpp>
 #include <glm/glm/gtc/matrix_transform.hpp>
@@ -10,10 +13,42 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <unordered_map>
 
 using namespace std;
 using namespace glm;
 
+// GL type a uniform must be declared with to be set from T
+template <typename T> struct UniformType;
+template <> struct UniformType<bool> { static const GLenum glType = GL_BOOL; };
+template <> struct UniformType<int> { static const GLenum glType = GL_INT; };
+template <> struct UniformType<float> { static const GLenum glType = GL_FLOAT; };
+template <> struct UniformType<vec3> { static const GLenum glType = GL_FLOAT_VEC3; };
+template <> struct UniformType<vec4> { static const GLenum glType = GL_FLOAT_VEC4; };
+template <> struct UniformType<mat4> { static const GLenum glType = GL_FLOAT_MAT4; };
+
+// Uniform location resolved once, so setting it does no string work or driver lookup
+template <typename T>
+struct UniformHandle
+{
+	int location;
+
+	UniformHandle()
+	{
+		location = -1;
+	}
+
+	explicit UniformHandle(int location)
+	{
+		this->location = location;
+	}
+
+	bool IsValid() const
+	{
+		return location != -1;
+	}
+};
+
 class Shader
 {
 public:
@@ -104,31 +139,207 @@ public:
 		// Delete Shaders
 		glDeleteShader(vertex);
 		glDeleteShader(fragment);
+
+		reflectUniforms();
+		bindUniformBlocks();
+	}
+
+	// Compute program, needs a GL 4.3 context (see GLCapabilities::ComputeShader)
+	explicit Shader(const GLchar* computePath)
+	{
+		ID = 0;
+#ifdef GL_VERSION_4_3
+		string computeCode;
+		ifstream computeShaderFile;
+		computeShaderFile.exceptions(ifstream::failbit | ifstream::badbit);
+		try
+		{
+			computeShaderFile.open(computePath);
+			stringstream computeShaderStream;
+			computeShaderStream << computeShaderFile.rdbuf();
+			computeShaderFile.close();
+			computeCode = computeShaderStream.str();
+		}
+		catch (const ifstream::failure&)
+		{
+			cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << endl;
+		}
+
+		const char* computeShaderCode = computeCode.c_str();
+		int success;
+		char infoLog[512];
+
+		// Compute Shader
+		unsigned int compute = glCreateShader(GL_COMPUTE_SHADER);
+		glShaderSource(compute, 1, &computeShaderCode, NULL);
+		glCompileShader(compute);
+
+		glGetShaderiv(compute, GL_COMPILE_STATUS, &success);
+		if (!success)
+		{
+			glGetShaderInfoLog(compute, 512, NULL, infoLog);
+			cout << "ERROR::SHADER::COMPUTE::COMPILATION_FAILED\n" << infoLog << endl;
+		}
+
+		// Shader Program
+		ID = glCreateProgram();
+		glAttachShader(ID, compute);
+		glLinkProgram(ID);
+
+		glGetProgramiv(ID, GL_LINK_STATUS, &success);
+		if (!success)
+		{
+			glGetProgramInfoLog(ID, 512, NULL, infoLog);
+			cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << endl;
+		}
+
+		glDeleteShader(compute);
+
+		reflectUniforms();
+		bindUniformBlocks();
+#endif
 	}
 
 	void use()
 	{
-		glUseProgram(ID);
+		GLState::UseProgram(ID);
+	}
+
+	// Resolves a uniform once, checking its declared type against T
+	template <typename T>
+	UniformHandle<T> getUniform(const string &name) const
+	{
+		unordered_map<string, ActiveUniform>::const_iterator uniform = uniforms.find(name);
+		if (uniform == uniforms.end())
+		{
+			return UniformHandle<T>();
+		}
+
+		// Samplers are set through int handles
+		GLenum type = uniform->second.type;
+		bool isSampler = type == GL_SAMPLER_2D || type == GL_SAMPLER_CUBE;
+		if (type != UniformType<T>::glType && !(isSampler && UniformType<T>::glType == GL_INT))
+		{
+			cout << "ERROR::SHADER::UNIFORM_TYPE_MISMATCH\n" << name << endl;
+			return UniformHandle<T>();
+		}
+
+		return UniformHandle<T>(uniform->second.location);
+	}
+
+	void set(UniformHandle<bool> uniform, bool value) const
+	{
+		glUniform1i(uniform.location, (int)value);
+	}
+
+	void set(UniformHandle<int> uniform, int value) const
+	{
+		glUniform1i(uniform.location, value);
+	}
+
+	void set(UniformHandle<float> uniform, float value) const
+	{
+		glUniform1f(uniform.location, value);
+	}
+
+	void set(UniformHandle<vec3> uniform, const vec3 &value) const
+	{
+		glUniform3fv(uniform.location, 1, glm::value_ptr(value));
+	}
+
+	void set(UniformHandle<vec4> uniform, const vec4 &value) const
+	{
+		glUniform4fv(uniform.location, 1, glm::value_ptr(value));
+	}
+
+	void set(UniformHandle<vec4> uniform, const vec4* values, int count) const
+	{
+		glUniform4fv(uniform.location, count, glm::value_ptr(values[0]));
+	}
+
+	void set(UniformHandle<mat4> uniform, const mat4 &value) const
+	{
+		glUniformMatrix4fv(uniform.location, 1, GL_FALSE, glm::value_ptr(value));
 	}
 
 	void setBool(const string &name, bool value) const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+		glUniform1i(getUniformLocation(name), (int)value);
 	}
 
 	void setInt(const string &name, int value) const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+		glUniform1i(getUniformLocation(name), value);
 	}
 
 	void setFloat(const string &name, float value) const
 	{
-		glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+		glUniform1f(getUniformLocation(name), value);
+	}
+
+	void setMat4(const string &name, const mat4 &value) const
+	{
+		glUniformMatrix4fv(getUniformLocation(name), 1, GL_FALSE, glm::value_ptr(value));
+	}
+
+private:
+	struct ActiveUniform
+	{
+		int location;
+		GLenum type;
+	};
+
+	unordered_map<string, ActiveUniform> uniforms;
+
+	// Builds the uniform location table once after linking
+	void reflectUniforms()
+	{
+		int uniformCount;
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &uniformCount);
+
+		for (int i = 0; i < uniformCount; i++)
+		{
+			char name[256];
+			int length, size;
+			GLenum type;
+			glGetActiveUniform(ID, i, sizeof(name), &length, &size, &type, name);
+
+			// Uniform block members have no location
+			ActiveUniform uniform;
+			uniform.location = glGetUniformLocation(ID, name);
+			uniform.type = type;
+			if (uniform.location == -1)
+			{
+				continue;
+			}
+
+			// Arrays are reported as "name[0]", also register them as "name"
+			string uniformName(name, length);
+			if (uniformName.size() > 3 && uniformName.compare(uniformName.size() - 3, 3, "[0]") == 0)
+			{
+				uniforms[uniformName.substr(0, uniformName.size() - 3)] = uniform;
+			}
+			uniforms[uniformName] = uniform;
+		}
+	}
+
+	// Connects the shared uniform blocks this program declares to their fixed binding points
+	void bindUniformBlocks()
+	{
+		for (const UniformBlockBinding& block : uniformBlockBindings)
+		{
+			unsigned int blockIndex = glGetUniformBlockIndex(ID, block.name);
+			if (blockIndex != GL_INVALID_INDEX)
+			{
+				glUniformBlockBinding(ID, blockIndex, block.binding);
+			}
+		}
 	}
 
-	void setMat4(const string &name, mat4 value)
+	int getUniformLocation(const string &name) const
 	{
-		glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, glm::value_ptr(value));
+		unordered_map<string, ActiveUniform>::const_iterator uniform = uniforms.find(name);
+		return uniform != uniforms.end() ? uniform->second.location : -1;
 	}
 };
 
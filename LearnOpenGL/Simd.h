@@ -0,0 +1,10 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+// SSE2 is always available on x64 and is the default /arch on 32 bit MSVC builds
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define USE_SSE 1
+#include <emmintrin.h>
+#endif
+
+#endif
@@ -0,0 +1,186 @@
+#ifndef TRANSFORM_STORE_H
+#define TRANSFORM_STORE_H
+
+#include "JobSystem.h"
+#include "Simd.h"
+
+#include <glm/glm/glm.hpp>
+#include <glm/glm/gtc/quaternion.hpp>
+#include <vector>
+
+using namespace std;
+using namespace glm;
+
+// Position, rotation and scale of many objects, one array per component (SoA)
+// ComputeMatrices turns them into column major model matrices four at a time, the same as
+// translate(position) * mat4_cast(rotation) * scale(scale)
+class TransformStore
+{
+public:
+	// Transforms per job when computing in parallel, a multiple of 4
+	static const int PARALLEL_GRAIN_SIZE = 16384;
+
+	int Add(const vec3& position, const quat& rotation = quat(1.0f, 0.0f, 0.0f, 0.0f), const vec3& scale = vec3(1.0f))
+	{
+		positionX.push_back(position.x);
+		positionY.push_back(position.y);
+		positionZ.push_back(position.z);
+		rotationX.push_back(rotation.x);
+		rotationY.push_back(rotation.y);
+		rotationZ.push_back(rotation.z);
+		rotationW.push_back(rotation.w);
+		scaleX.push_back(scale.x);
+		scaleY.push_back(scale.y);
+		scaleZ.push_back(scale.z);
+		return GetCount() - 1;
+	}
+
+	int GetCount() const
+	{
+		return (int)positionX.size();
+	}
+
+	void SetPosition(int index, const vec3& position)
+	{
+		positionX[index] = position.x;
+		positionY[index] = position.y;
+		positionZ[index] = position.z;
+	}
+
+	vec3 GetPosition(int index) const
+	{
+		return vec3(positionX[index], positionY[index], positionZ[index]);
+	}
+
+	// Expects a unit quaternion
+	void SetRotation(int index, const quat& rotation)
+	{
+		rotationX[index] = rotation.x;
+		rotationY[index] = rotation.y;
+		rotationZ[index] = rotation.z;
+		rotationW[index] = rotation.w;
+	}
+
+	void SetScale(int index, const vec3& scale)
+	{
+		scaleX[index] = scale.x;
+		scaleY[index] = scale.y;
+		scaleZ[index] = scale.z;
+	}
+
+	// Writes the model matrices of [begin, end) to matrices[0] onwards
+	// matrices can point anywhere, a partition's array or a mapped instance buffer
+	// stream bypasses the cache with non-temporal stores, only worth it for a mapped buffer or a batch too large to be read back from cache
+	void ComputeMatrices(int begin, int end, mat4* matrices, bool stream = false) const
+	{
+		int i = begin;
+
+#ifdef USE_SSE
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 two = _mm_set1_ps(2.0f);
+		const __m128 zero = _mm_setzero_ps();
+
+		// Non-temporal stores need 16 byte aligned output
+		float* output = (float*)matrices;
+		stream = stream && ((size_t)output & 15) == 0;
+
+		for (; i + 4 <= end; i += 4)
+		{
+			__m128 x = _mm_loadu_ps(&rotationX[i]);
+			__m128 y = _mm_loadu_ps(&rotationY[i]);
+			__m128 z = _mm_loadu_ps(&rotationZ[i]);
+			__m128 w = _mm_loadu_ps(&rotationW[i]);
+
+			__m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+			__m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+			__m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y), wz = _mm_mul_ps(w, z);
+
+			__m128 sx = _mm_loadu_ps(&scaleX[i]);
+			__m128 sy = _mm_loadu_ps(&scaleY[i]);
+			__m128 sz = _mm_loadu_ps(&scaleZ[i]);
+
+			// Rotation columns scaled by the matching axis scale, one lane per object
+			// Each column is transposed from four lanes of x, y, z, w to one vec4 per object and stored right away
+			StoreColumn(output, 0, stream,
+						_mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), sx),
+						_mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xy, wz)), sx),
+						_mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xz, wy)), sx),
+						zero);
+			StoreColumn(output, 1, stream,
+						_mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xy, wz)), sy),
+						_mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), sy),
+						_mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(yz, wx)), sy),
+						zero);
+			StoreColumn(output, 2, stream,
+						_mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xz, wy)), sz),
+						_mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(yz, wx)), sz),
+						_mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))), sz),
+						zero);
+			StoreColumn(output, 3, stream, _mm_loadu_ps(&positionX[i]), _mm_loadu_ps(&positionY[i]), _mm_loadu_ps(&positionZ[i]), one);
+			output += 64;
+		}
+
+		if (stream)
+		{
+			_mm_sfence(); // Streaming stores are weakly ordered, make them visible before the matrices are handed on
+		}
+#endif
+
+		// Remaining transforms (or all of them without SSE)
+		for (; i < end; i++)
+		{
+			matrices[i - begin] = ComputeMatrix(i);
+		}
+	}
+
+	// Every transform, split across the job system when there are enough of them
+	void ComputeMatrices(mat4* matrices, bool stream = false) const
+	{
+		JobSystem::ParallelFor(GetCount(), PARALLEL_GRAIN_SIZE, [this, matrices, stream](int begin, int end)
+		{
+			ComputeMatrices(begin, end, matrices + begin, stream);
+		});
+	}
+
+	mat4 ComputeMatrix(int index) const
+	{
+		float x = rotationX[index], y = rotationY[index], z = rotationZ[index], w = rotationW[index];
+
+		mat4 matrix(1.0f);
+		matrix[0] = vec4(1.0f - 2.0f * (y * y + z * z), 2.0f * (x * y + w * z), 2.0f * (x * z - w * y), 0.0f) * scaleX[index];
+		matrix[1] = vec4(2.0f * (x * y - w * z), 1.0f - 2.0f * (x * x + z * z), 2.0f * (y * z + w * x), 0.0f) * scaleY[index];
+		matrix[2] = vec4(2.0f * (x * z + w * y), 2.0f * (y * z - w * x), 1.0f - 2.0f * (x * x + y * y), 0.0f) * scaleZ[index];
+		matrix[3] = vec4(positionX[index], positionY[index], positionZ[index], 1.0f);
+		return matrix;
+	}
+
+private:
+	vector<float> positionX, positionY, positionZ;
+	vector<float> rotationX, rotationY, rotationZ, rotationW;
+	vector<float> scaleX, scaleY, scaleZ;
+
+#ifdef USE_SSE
+	// Column of four consecutive matrices, given as one register per component
+	// With stream the output has to be 16 byte aligned and the stores are non-temporal
+	static void StoreColumn(float* output, int column, bool stream, __m128 x, __m128 y, __m128 z, __m128 w)
+	{
+		_MM_TRANSPOSE4_PS(x, y, z, w);
+		if (stream)
+		{
+			_mm_stream_ps(output + column * 4, x);
+			_mm_stream_ps(output + 16 + column * 4, y);
+			_mm_stream_ps(output + 32 + column * 4, z);
+			_mm_stream_ps(output + 48 + column * 4, w);
+		}
+		else
+		{
+			_mm_storeu_ps(output + column * 4, x);
+			_mm_storeu_ps(output + 16 + column * 4, y);
+			_mm_storeu_ps(output + 32 + column * 4, z);
+			_mm_storeu_ps(output + 48 + column * 4, w);
+		}
+	}
+#endif
+};
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef UNIFORM_BUFFER_H
+#define UNIFORM_BUFFER_H
+
+#include "Camera.h"
+#include "GLState.h"
+
+#include <glad/glad.h>
+#include <glm/glm/glm.hpp>
+
+using namespace glm;
+
+// Binding points shared by every shader program
+const unsigned int CAMERA_BLOCK_BINDING = 0;
+
+struct UniformBlockBinding
+{
+	const char* name;
+	unsigned int binding;
+};
+
+// Shader binds any of these blocks it declares to the matching binding point when it links
+const UniformBlockBinding uniformBlockBindings[] = {
+	{ "Camera", CAMERA_BLOCK_BINDING }
+};
+
+class UniformBuffer
+{
+public:
+	UniformBuffer(int size, unsigned int binding)
+	{
+		glGenBuffers(1, &UBO);
+		GLState::BindBuffer(GL_UNIFORM_BUFFER, UBO);
+		glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+		glBindBufferBase(GL_UNIFORM_BUFFER, binding, UBO); // Every program reading this binding point now sees this buffer
+		GLState::BindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+
+	void Update(const void* data, int size, int offset = 0)
+	{
+		GLState::BindBuffer(GL_UNIFORM_BUFFER, UBO);
+		glBufferSubData(GL_UNIFORM_BUFFER, offset, size, data);
+		GLState::BindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+
+private:
+	unsigned int UBO;
+};
+
+// Mirrors the std140 "Camera" block in the shaders
+// mat4 and vec4 members are already 16 byte aligned, so no padding is needed
+struct CameraBlock
+{
+	mat4 viewMatrix;
+	mat4 projectionMatrix;
+	mat4 viewProjectionMatrix;
+	vec4 position;
+
+	static CameraBlock FromCamera(Camera& camera)
+	{
+		CameraBlock block;
+		block.viewMatrix = camera.GetViewMatrix();
+		block.projectionMatrix = camera.GetProjectionMatrix();
+		block.viewProjectionMatrix = camera.GetViewProjectionMatrix();
+		block.position = vec4(camera.position, 1.0f);
+		return block;
+	}
+};
+
+// Camera state uploaded once per frame and shared by all shader programs
+class CameraUniformBuffer
+{
+public:
+	CameraUniformBuffer() : buffer(sizeof(CameraBlock), CAMERA_BLOCK_BINDING)
+	{
+	}
+
+	void Update(Camera& camera)
+	{
+		Update(CameraBlock::FromCamera(camera));
+	}
+
+	// For camera state captured on another thread
+	void Update(const CameraBlock& block)
+	{
+		buffer.Update(&block, sizeof(CameraBlock));
+	}
+
+private:
+	UniformBuffer buffer;
+};
+
+#endif
@@ -0,0 +1,301 @@
+#ifndef VERTEX_LAYOUT_H
+#define VERTEX_LAYOUT_H
+
+#include "Bounds.h"
+#include "GLState.h"
+
+#include <glad/glad.h>
+#include <glm/glm/glm.hpp>
+#include <glm/glm/gtc/matrix_transform.hpp>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+using namespace glm;
+
+// Attribute locations shared with the vertex shaders
+const unsigned int POSITION_LOCATION = 0;
+const unsigned int UV_LOCATION = 1;
+const unsigned int INSTANCE_MATRIX_LOCATION = 2; // mat4, takes locations 2 to 5
+const unsigned int NORMAL_LOCATION = 6;
+
+// Attributes present in a source vertex, in this order, as floats
+enum VertexAttributes
+{
+	VERTEX_POSITION = 1,	// 3 floats
+	VERTEX_UV = 2,			// 2 floats
+	VERTEX_NORMAL = 4		// 3 floats
+};
+
+// How attributes are split between vertex buffers
+enum VertexStreams
+{
+	INTERLEAVED_STREAM,		// Every attribute in one buffer
+	SPLIT_POSITION_STREAM	// Positions alone in stream 0, so depth and shadow passes only fetch positions, the rest in stream 1
+};
+
+// Declarative description of a mesh's vertices, from which Object builds its buffers and VAO
+struct VertexFormat
+{
+	int attributes;			// VertexAttributes present in the float source vertices
+	bool quantized;			// Compressed GPU encoding, see VertexEncoder
+	VertexStreams streams;
+
+	VertexFormat(int attributes = VERTEX_POSITION | VERTEX_UV, bool quantized = false, VertexStreams streams = INTERLEAVED_STREAM)
+	{
+		this->attributes = attributes;
+		this->quantized = quantized;
+		this->streams = streams;
+	}
+};
+
+struct VertexAttribute
+{
+	unsigned int location;
+	int components;
+	GLenum type;
+	bool normalized;
+	int stream;		// Vertex buffer holding the attribute
+	int offset;		// Byte offset inside a vertex of that buffer
+};
+
+// Describes how vertex data is laid out across one or more buffers, and sets up the matching glVertexAttribPointer calls
+class VertexLayout
+{
+public:
+	vector<VertexAttribute> attributes;
+	vector<int> strides; // One per stream
+
+	VertexLayout& Add(unsigned int location, int components, GLenum type, bool normalized, int stream = 0)
+	{
+		if (stream >= (int)strides.size())
+		{
+			strides.resize(stream + 1, 0);
+		}
+
+		VertexAttribute attribute;
+		attribute.location = location;
+		attribute.components = components;
+		attribute.type = type;
+		attribute.normalized = normalized;
+		attribute.stream = stream;
+		attribute.offset = strides[stream];
+		attributes.push_back(attribute);
+
+		// Attributes stay 4 byte aligned
+		strides[stream] += (AttributeSize(attribute) + 3) & ~3;
+		return *this;
+	}
+
+	int GetStreamCount() const
+	{
+		return (int)strides.size();
+	}
+
+	// Applies the layout to the currently bound VAO, buffers[i] holds stream i
+	void Apply(const unsigned int* buffers) const
+	{
+		for (size_t i = 0; i < attributes.size(); i++)
+		{
+			const VertexAttribute& attribute = attributes[i];
+			GLState::BindBuffer(GL_ARRAY_BUFFER, buffers[attribute.stream]);
+			glVertexAttribPointer(attribute.location, attribute.components, attribute.type, attribute.normalized ? GL_TRUE : GL_FALSE,
+								  strides[attribute.stream], (void*)(size_t)attribute.offset);
+			glEnableVertexAttribArray(attribute.location);
+		}
+	}
+
+	bool operator==(const VertexLayout& other) const
+	{
+		if (strides != other.strides || attributes.size() != other.attributes.size())
+		{
+			return false;
+		}
+		for (size_t i = 0; i < attributes.size(); i++)
+		{
+			const VertexAttribute& a = attributes[i];
+			const VertexAttribute& b = other.attributes[i];
+			if (a.location != b.location || a.components != b.components || a.type != b.type || a.normalized != b.normalized ||
+				a.stream != b.stream || a.offset != b.offset)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	static int AttributeSize(const VertexAttribute& attribute)
+	{
+		switch (attribute.type)
+		{
+		case GL_INT_2_10_10_10_REV:
+		case GL_UNSIGNED_INT_2_10_10_10_REV:
+			return 4; // All four components packed in one 32 bit word
+		case GL_BYTE:
+		case GL_UNSIGNED_BYTE:
+			return attribute.components;
+		case GL_SHORT:
+		case GL_UNSIGNED_SHORT:
+		case GL_HALF_FLOAT:
+			return attribute.components * 2;
+		default:
+			return attribute.components * 4;
+		}
+	}
+
+	// Number of floats per source vertex
+	static int SourceStride(int vertexAttributes)
+	{
+		return ((vertexAttributes & VERTEX_POSITION) ? 3 : 0) + ((vertexAttributes & VERTEX_UV) ? 2 : 0) + ((vertexAttributes & VERTEX_NORMAL) ? 3 : 0);
+	}
+};
+
+// Converts float vertices into the GPU vertex format
+// Quantized vertices use 16 bit snorm positions, 16 bit unorm UVs and 10_10_10_2 snorm normals, the hardware
+// normalizes them on fetch and the position decode matrix (folded into the model matrix) restores the mesh extents
+class VertexEncoder
+{
+public:
+	// Writes one byte array per stream of the resulting layout
+	static void Encode(const vector<float>& vertices, const VertexFormat& format,
+					   vector<vector<unsigned char> >& encodedStreams, VertexLayout& layout, mat4& positionDecode)
+	{
+		int sourceStride = VertexLayout::SourceStride(format.attributes);
+		int vertexCount = (int)vertices.size() / sourceStride;
+		int uvOffset = 3;
+		int normalOffset = (format.attributes & VERTEX_UV) ? 5 : 3;
+		bool quantize = format.quantized;
+		int attributeStream = format.streams == SPLIT_POSITION_STREAM ? 1 : 0;
+
+		// Positions are mapped from the mesh bounds to [-1, 1]
+		AABB bounds = AABB::FromVertices(vertices.data(), vertexCount, sourceStride);
+		vec3 center = bounds.GetCenter();
+		vec3 extents = glm::max(bounds.GetExtents(), vec3(1e-6f));
+
+		// Unorm UVs can only hold [0, 1], meshes with tiling UVs keep floats
+		bool quantizeUVs = quantize;
+		if (format.attributes & VERTEX_UV)
+		{
+			for (int i = 0; i < vertexCount && quantizeUVs; i++)
+			{
+				float u = vertices[i * sourceStride + uvOffset];
+				float v = vertices[i * sourceStride + uvOffset + 1];
+				quantizeUVs = u >= 0.0f && u <= 1.0f && v >= 0.0f && v <= 1.0f;
+			}
+		}
+
+		layout = VertexLayout();
+		if (quantize)
+		{
+			layout.Add(POSITION_LOCATION, 4, GL_SHORT, true); // Fourth short pads the position to 8 bytes
+			positionDecode = scale(translate(mat4(1.0f), center), extents);
+		}
+		else
+		{
+			layout.Add(POSITION_LOCATION, 3, GL_FLOAT, false);
+			positionDecode = mat4(1.0f);
+		}
+		if (format.attributes & VERTEX_UV)
+		{
+			layout.Add(UV_LOCATION, 2, quantizeUVs ? GL_UNSIGNED_SHORT : GL_FLOAT, quantizeUVs, attributeStream);
+		}
+		if (format.attributes & VERTEX_NORMAL)
+		{
+			if (quantize)
+			{
+				layout.Add(NORMAL_LOCATION, 4, GL_INT_2_10_10_10_REV, true, attributeStream);
+			}
+			else
+			{
+				layout.Add(NORMAL_LOCATION, 3, GL_FLOAT, false, attributeStream);
+			}
+		}
+
+		encodedStreams.resize(layout.GetStreamCount());
+		for (int stream = 0; stream < layout.GetStreamCount(); stream++)
+		{
+			encodedStreams[stream].assign(vertexCount * layout.strides[stream], 0);
+		}
+
+		for (int i = 0; i < vertexCount; i++)
+		{
+			const float* source = &vertices[i * sourceStride];
+
+			for (size_t a = 0; a < layout.attributes.size(); a++)
+			{
+				const VertexAttribute& attribute = layout.attributes[a];
+				unsigned char* output = &encodedStreams[attribute.stream][i * layout.strides[attribute.stream] + attribute.offset];
+
+				if (attribute.location == POSITION_LOCATION)
+				{
+					if (quantize)
+					{
+						short position[4];
+						for (int c = 0; c < 3; c++)
+						{
+							position[c] = EncodeSnorm16((source[c] - center[c]) / extents[c]);
+						}
+						position[3] = 0;
+						memcpy(output, position, sizeof(position));
+					}
+					else
+					{
+						memcpy(output, source, 3 * sizeof(float));
+					}
+				}
+				else if (attribute.location == UV_LOCATION)
+				{
+					if (quantizeUVs)
+					{
+						unsigned short uv[2] = { EncodeUnorm16(source[uvOffset]), EncodeUnorm16(source[uvOffset + 1]) };
+						memcpy(output, uv, sizeof(uv));
+					}
+					else
+					{
+						memcpy(output, source + uvOffset, 2 * sizeof(float));
+					}
+				}
+				else if (attribute.location == NORMAL_LOCATION)
+				{
+					if (quantize)
+					{
+						unsigned int normal = PackNormal(vec3(source[normalOffset], source[normalOffset + 1], source[normalOffset + 2]));
+						memcpy(output, &normal, sizeof(normal));
+					}
+					else
+					{
+						memcpy(output, source + normalOffset, 3 * sizeof(float));
+					}
+				}
+			}
+		}
+	}
+
+	static short EncodeSnorm16(float value)
+	{
+		value = value < -1.0f ? -1.0f : (value > 1.0f ? 1.0f : value);
+		return (short)floor(value * 32767.0f + 0.5f);
+	}
+
+	static unsigned short EncodeUnorm16(float value)
+	{
+		value = value < 0.0f ? 0.0f : (value > 1.0f ? 1.0f : value);
+		return (unsigned short)floor(value * 65535.0f + 0.5f);
+	}
+
+	// GL_INT_2_10_10_10_REV, x in the lowest 10 bits, w left at 0
+	static unsigned int PackNormal(const vec3& normal)
+	{
+		unsigned int packed = 0;
+		for (int c = 0; c < 3; c++)
+		{
+			float value = normal[c] < -1.0f ? -1.0f : (normal[c] > 1.0f ? 1.0f : normal[c]);
+			int component = (int)floor(value * 511.0f + 0.5f);
+			packed |= ((unsigned int)component & 0x3FF) << (c * 10);
+		}
+		return packed;
+	}
+};
+
+#endif
@@ -2,10 +2,24 @@
 
 out vec4 fragmentColor;
 in vec2 uv;
+flat in float lodFade; // Above 0 for the level fading in, below 0 for the one fading out
 
 uniform sampler2D textureSample;
 
+// 4x4 ordered dither thresholds
+const float ditherMatrix[16] = float[](0.0, 8.0, 2.0, 10.0, 12.0, 4.0, 14.0, 6.0, 3.0, 11.0, 1.0, 9.0, 15.0, 7.0, 13.0, 5.0);
+
 void main()
 {
+	// Both levels of a fade use the same pattern, the incoming one keeps the pixels the outgoing one drops
+	if (lodFade != 0.0)
+	{
+		float threshold = (ditherMatrix[(int(gl_FragCoord.y) & 3) * 4 + (int(gl_FragCoord.x) & 3)] + 0.5) / 16.0;
+		if (lodFade > 0.0 ? threshold >= lodFade : threshold < lodFade + 1.0)
+		{
+			discard;
+		}
+	}
+
 	fragmentColor = texture(textureSample, uv);
 }
\ No newline at end of file
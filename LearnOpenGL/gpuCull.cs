@@ -0,0 +1,126 @@
+#version 430 core
+
+layout (local_size_x = 64) in;
+
+// Mirrors GPUInstance
+struct Instance
+{
+	mat4 worldMatrix;
+	uint mesh;
+	uint padding0;
+	uint padding1;
+	uint padding2;
+};
+
+// Mirrors GPUCuller::Mesh
+struct Mesh
+{
+	mat4 decodeMatrix;
+	vec4 boundingSphere;
+};
+
+// Mirrors DrawElementsIndirectCommand
+struct DrawCommand
+{
+	uint count;
+	uint instanceCount;
+	uint firstIndex;
+	int baseVertex;
+	uint baseInstance;
+};
+
+layout (std430, binding = 0) readonly buffer Instances { Instance instances[]; };
+layout (std430, binding = 1) readonly buffer Meshes { Mesh meshes[]; };
+layout (std430, binding = 2) buffer DrawCommands { DrawCommand commands[]; };
+layout (std430, binding = 3) writeonly buffer VisibleMatrices { mat4 visibleMatrices[]; };
+
+layout (binding = 0) uniform sampler2D hiZ; // Farthest depth per texel, built from the previous frame
+
+uniform int instanceCount;
+uniform vec4 frustumPlanes[6]; // Normals pointing inside, see Frustum
+uniform bool occlusionEnabled;
+uniform mat4 previousViewProjection; // Camera the pyramid was drawn with
+
+bool IsInFrustum(vec3 center, float radius)
+{
+	for (int i = 0; i < 6; i++)
+	{
+		if (dot(frustumPlanes[i].xyz, center) + frustumPlanes[i].w < -radius)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// True when the nearest point of the sphere's box is behind the farthest depth everywhere the box covers
+bool IsOccluded(vec3 center, float radius)
+{
+	vec2 screenMin = vec2(1.0);
+	vec2 screenMax = vec2(0.0);
+	float nearestDepth = 1.0;
+	for (int corner = 0; corner < 8; corner++)
+	{
+		vec3 offset = vec3(corner & 1, (corner >> 1) & 1, (corner >> 2) & 1) * 2.0 - 1.0;
+		vec4 clip = previousViewProjection * vec4(center + offset * radius, 1.0);
+		if (clip.w <= 0.0)
+		{
+			return false; // Crosses the eye plane
+		}
+
+		vec3 ndc = clip.xyz / clip.w;
+		screenMin = min(screenMin, ndc.xy * 0.5 + 0.5);
+		screenMax = max(screenMax, ndc.xy * 0.5 + 0.5);
+		nearestDepth = min(nearestDepth, ndc.z * 0.5 + 0.5);
+	}
+
+	// Level where the rectangle spans at most two texels each way
+	vec2 size = vec2(textureSize(hiZ, 0));
+	vec2 pixelMin = clamp(screenMin, 0.0, 1.0) * size;
+	vec2 pixelMax = clamp(screenMax, 0.0, 1.0) * size;
+	vec2 extent = pixelMax - pixelMin;
+	int level = clamp(int(ceil(log2(max(max(extent.x, extent.y), 1.0)))), 0, textureQueryLevels(hiZ) - 1);
+
+	// Last texels of odd sized levels also cover the leftover pixels, hence the clamp
+	// The level size is derived rather than queried, llvmpipe returns one invocation's textureSize for every lod
+	ivec2 levelSize = max(ivec2(size) >> level, ivec2(1));
+	ivec2 first = min(ivec2(pixelMin) >> level, levelSize - 1);
+	ivec2 last = min(ivec2(min(pixelMax, size - 1.0)) >> level, levelSize - 1);
+
+	float farthest = 0.0;
+	for (int y = first.y; y <= last.y; y++)
+	{
+		for (int x = first.x; x <= last.x; x++)
+		{
+			farthest = max(farthest, texelFetch(hiZ, ivec2(x, y), level).r);
+		}
+	}
+	return nearestDepth > farthest;
+}
+
+void main()
+{
+	uint index = gl_GlobalInvocationID.x;
+	if (index >= uint(instanceCount))
+	{
+		return;
+	}
+
+	Instance instance = instances[index];
+	Mesh mesh = meshes[instance.mesh];
+
+	// World space sphere, the radius grows with the largest axis scale
+	mat4 worldMatrix = instance.worldMatrix;
+	vec3 center = (worldMatrix * vec4(mesh.boundingSphere.xyz, 1.0)).xyz;
+	float scale = max(length(worldMatrix[0].xyz), max(length(worldMatrix[1].xyz), length(worldMatrix[2].xyz)));
+	float radius = mesh.boundingSphere.w * scale;
+
+	if (!IsInFrustum(center, radius) || (occlusionEnabled && IsOccluded(center, radius)))
+	{
+		return;
+	}
+
+	// Survivors are appended to their mesh's range of the output, the counter is the draw's instance count
+	uint slot = atomicAdd(commands[instance.mesh].instanceCount, 1u);
+	visibleMatrices[commands[instance.mesh].baseInstance + slot] = worldMatrix * mesh.decodeMatrix;
+}
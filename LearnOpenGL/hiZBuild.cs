@@ -0,0 +1,41 @@
+#version 430 core
+
+layout (local_size_x = 8, local_size_y = 8) in;
+
+layout (binding = 0) uniform sampler2D source; // Depth texture when copying, the pyramid itself otherwise
+layout (binding = 0, r32f) writeonly uniform image2D destination; // Level being built
+
+uniform bool copyDepth;
+uniform int sourceLevel;
+
+void main()
+{
+	ivec2 position = ivec2(gl_GlobalInvocationID.xy);
+	ivec2 destinationSize = imageSize(destination);
+	if (any(greaterThanEqual(position, destinationSize)))
+	{
+		return;
+	}
+
+	if (copyDepth)
+	{
+		imageStore(destination, position, vec4(texelFetch(source, position, 0).r));
+		return;
+	}
+
+	// Farthest of the 2x2 texels above, the last row and column also take the leftover texel of odd sizes
+	// so every texel of the pyramid covers whatever it could be looked up for
+	ivec2 sourceSize = textureSize(source, sourceLevel);
+	ivec2 first = position * 2;
+	ivec2 last = min(first + 1 + ivec2(equal(position, destinationSize - 1)) * (sourceSize & 1), sourceSize - 1);
+
+	float farthest = 0.0;
+	for (int y = first.y; y <= last.y; y++)
+	{
+		for (int x = first.x; x <= last.x; x++)
+		{
+			farthest = max(farthest, texelFetch(source, ivec2(x, y), sourceLevel).r);
+		}
+	}
+	imageStore(destination, position, vec4(farthest));
+}
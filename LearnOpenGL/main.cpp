@@ -2,15 +2,85 @@
 
 #include "Shader.h"
 #include "Object.h"
+#include "Benchmarks.h"
+#include "BVH.h"
 #include "Camera.h"
+#include "CommandBuffer.h"
+#include "DrawBatcher.h"
+#include "EntityWorld.h"
+#include "Frustum.h"
+#include "GLCommandBackend.h"
+#include "GLState.h"
+#include "FramePipeline.h"
+#include "GPUCuller.h"
+#include "HardwareOcclusion.h"
+#include "InstanceBuffer.h"
+#include "JobSystem.h"
+#include "LevelOfDetail.h"
+#include "OcclusionCuller.h"
+#include "RenderQueue.h"
+#include "SceneGraph.h"
+#include "TransformStore.h"
+#include "UniformBuffer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
 
 using namespace std;
 using namespace glm;
 
 const int width = 800;
 const int height = 600;
+const bool hardwareOcclusion = false; // GPU occlusion queries and conditional rendering instead of the CPU occlusion buffer
+const bool gpuDrivenRendering = false; // Frustum and Hi-Z culling in compute shaders, needs GL 4.3 and falls back to the CPU path without it
+const bool lodCrossFade = true; // Dithers between the old and new level of detail instead of popping
+const bool instancedRendering = !hardwareOcclusion; // Draws every mesh's instances through the indirect draw batcher, conditional rendering needs one draw per object
+const int frameLatency = 1; // Frames the simulation thread may run ahead of rendering, 1 or 2
+const int maxOccluders = 16; // Nearest visible entities rasterized into the occlusion buffer each frame
 GLFWwindow* window;
 
+// One entity chunk's culling and sorting state, filled by the job recording that chunk
+struct ScenePartition
+{
+	vector<int> visibleEntities;
+	vector<mat4> visibleMatrices;
+	RenderQueue renderQueue;
+	int occludedCount;
+	int triangleCount;
+	vector<IndexRange> visibleRanges; // Meshlets left of the entity being recorded
+	int meshletCount;
+	int visibleMeshletCount;
+};
+
+// Visible entity that may hide others, the nearest ones are rasterized
+struct OccluderCandidate
+{
+	float depth;
+	Object* object;
+	const mat4* worldMatrix;
+};
+
+// Everything the render thread needs for one frame, built by the simulation thread
+struct FrameSnapshot
+{
+	long long frame;
+	CameraBlock camera;
+	CommandBuffer frameCommands;			// Per-frame state, replayed before the partitions
+	vector<CommandBuffer> partitionCommands;
+	vector<CommandBuffer> occlusionCommands; // Bounding box queries of each partition, replayed after every draw
+	vector<GPUInstanceUpdate> gpuInstanceUpdates; // Instances whose scene node moved this frame, in GPU-driven mode
+
+	int visibleCount;
+	int culledCount;
+	int occludedCount;
+	int triangleCount;
+	int meshletCount;		 // Of the entities drawn at a level with meshlets
+	int visibleMeshletCount;
+};
+
 // Input Function
 void processInput(GLFWwindow* window)
 {
@@ -25,20 +95,37 @@ void processInput(GLFWwindow* window)
 void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 {
 	// OpenGL Viewport
-	glViewport(0, 0, width, height); // X and Y of the lower left corner of the viewport, then Width and Height
+	GLState::SetViewport(0, 0, width, height); // X and Y of the lower left corner of the viewport, then Width and Height
 									 // Note: OpenGL renders from coordinates -1 to 1, then translates those coordinates to the viewport's dimension
 }
 
-int main()
+int main(int argc, char** argv)
 {
+	// CPU benchmarks only, no window
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--benchmark") == 0)
+		{
+			Benchmarks::Run();
+			return 0;
+		}
+	}
+
 	// GLFW Window Initialization
+	// GL 4.3 is asked first for compute shaders and indirect draws, 3.3 core is enough for everything else
 	glfwInit();
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3); // Major OpenGL Version
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4); // Major OpenGL Version
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3); // Minor OpenGL Version
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
 	// Create Window Object
 	GLFWwindow* window = glfwCreateWindow(width, height, "LearnOpenGL", NULL, NULL); // Create window with Width, Height and Name
+	if (window == NULL)
+	{
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+		window = glfwCreateWindow(width, height, "LearnOpenGL", NULL, NULL);
+	}
 	if (window == NULL) // Error Handler
 	{
 		cout << "Failed to create GLFW window" << endl;
@@ -56,10 +143,21 @@ int main()
 		return -1;
 	}
 
+	// The CPU culling path stays in use when the context turned out older than 4.3
+	const bool gpuDriven = gpuDrivenRendering && GLCapabilities::ComputeShader();
+	if (gpuDrivenRendering && !gpuDriven)
+	{
+		cout << "GL 4.3 unavailable, culling on the CPU" << endl;
+	}
+
+	// Worker threads for the CPU side of the frame and asset loading, the main thread is worker 0
+	// One more worker is reserved for the simulation thread
+	JobSystem::Initialize(0, 1);
+
 	Shader shader("vertexShader.vs", "fragmentShader.fs");
 
 	// Depth Testing
-	glEnable(GL_DEPTH_TEST); // Enables depth testing (z-buffer)
+	GLState::SetEnabled(GL_DEPTH_TEST, true); // Enables depth testing (z-buffer)
 
 	// Ortographic Projection Matrix
 	glm::ortho(0.0f,	// Frustrum Left Coordinate
@@ -83,11 +181,11 @@ int main()
 	// Triangle Vertices
 	float vertices[] = {
 		-0.5f, -0.5f, -0.5f,  0.0f, 0.0f,
-		0.5f, -0.5f, -0.5f,  1.0f, 0.0f,
 		0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
+		0.5f, -0.5f, -0.5f,  1.0f, 0.0f,
 		0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
-		-0.5f,  0.5f, -0.5f,  0.0f, 1.0f,
 		-0.5f, -0.5f, -0.5f,  0.0f, 0.0f,
+		-0.5f,  0.5f, -0.5f,  0.0f, 1.0f,
 
 		-0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
 		0.5f, -0.5f,  0.5f,  1.0f, 0.0f,
@@ -104,11 +202,11 @@ int main()
 		-0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
 
 		0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-		0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
 		0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
+		0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
 		0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-		0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
 		0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
+		0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
 
 		-0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
 		0.5f, -0.5f, -0.5f,  1.0f, 1.0f,
@@ -118,16 +216,11 @@ int main()
 		-0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
 
 		-0.5f,  0.5f, -0.5f,  0.0f, 1.0f,
-		0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
 		0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
+		0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
 		0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-		-0.5f,  0.5f,  0.5f,  0.0f, 0.0f,
-		-0.5f,  0.5f, -0.5f,  0.0f, 1.0f
-	};
-
-	unsigned int indices[] = {
-		0, 1, 3,
-		1, 2, 3
+		-0.5f,  0.5f, -0.5f,  0.0f, 1.0f,
+		-0.5f,  0.5f,  0.5f,  0.0f, 0.0f
 	};
 
 	glm::vec3 cubePositions[] = {
@@ -142,145 +235,529 @@ int main()
 		glm::vec3(1.5f,  0.2f, -1.5f),
 		glm::vec3(-1.3f,  1.0f, -1.5f)
 	};
+	const int cubeCount = sizeof(cubePositions) / sizeof(cubePositions[0]);
+
+	// Cube Mesh
+	// No indices are given, so the 36 vertices are welded down to 16 unique ones and drawn indexed
+	// Stored quantized, 12 bytes per vertex instead of 20, with positions in their own stream
+	VertexFormat cubeFormat(VERTEX_POSITION | VERTEX_UV, true, SPLIT_POSITION_STREAM);
+	Object cube(vector<float>(vertices, vertices + sizeof(vertices) / sizeof(float)), vector<unsigned int>(), "volt.jpg", cubeFormat);
+
+	const MeshOptimizationStats& cubeStats = cube.GetOptimizationStats();
+	cout << "Cube mesh ACMR: " << cubeStats.before.ACMR << " -> " << cubeStats.after.ACMR
+		 << ", ATVR: " << cubeStats.before.ATVR << " -> " << cubeStats.after.ATVR << endl;
+
+	// Sphere Mesh
+	// Dense enough that distant spheres are worth simplifying, four levels of detail from about 3000 triangles down
+	vector<float> sphereVertices;
+	vector<unsigned int> sphereIndices;
+	MeshBuilder::Sphere(32, 48, sphereVertices, sphereIndices);
+	Object sphere(sphereVertices, sphereIndices, "container.jpg", cubeFormat, 4);
+	const int sphereRows = 4;
+	const int sphereColumns = 6;
+	const int sphereCount = sphereRows * sphereColumns;
+
+	// Large Sphere Mesh
+	// About 16000 triangles, split into meshlets that are culled on their own when it is drawn at level 0
+	vector<float> largeSphereVertices;
+	vector<unsigned int> largeSphereIndices;
+	MeshBuilder::Sphere(64, 128, largeSphereVertices, largeSphereIndices);
+	for (size_t i = 0; i < largeSphereVertices.size(); i += 5)
+	{
+		largeSphereVertices[i] *= 6.0f;
+		largeSphereVertices[i + 1] *= 6.0f;
+		largeSphereVertices[i + 2] *= 6.0f;
+	}
+	Object largeSphere(largeSphereVertices, largeSphereIndices, "weed.jpg", cubeFormat, 4);
 
-	unsigned int VAO; // Vertex Array Object
-					  // Stores vertex attribute configutarions and associated VBO's
+	// Cube Transforms
+	// Animated in place, then turned into local matrices four at a time
+	TransformStore cubeTransforms;
+	for (int i = 0; i < cubeCount; i++)
+	{
+		cubeTransforms.Add(cubePositions[i]);
+	}
+	vector<mat4> cubeLocalMatrices(cubeCount);
+	const vec3 cubeRotationAxis = normalize(vec3(1.0f, 0.3f, 0.5f));
+
+	// Scene Hierarchy
+	// Every cube is a node under one root, the transform store gives their local matrices
+	// Only the nodes set each frame and their children get new world matrices
+	SceneGraph scene;
+	int sceneRoot = scene.CreateNode();
+	vector<int> cubeNodes(cubeCount);
+	for (int i = 0; i < cubeCount; i++)
+	{
+		cubeNodes[i] = scene.CreateNode(sceneRoot, cubeTransforms.ComputeMatrix(i));
+	}
 
-	glGenVertexArrays(1, &VAO); // Generates a buffer ID to this object
-	glBindVertexArray(VAO);		// Binds VAO first, then bind and set VBO's
+	// Scene Entities
+	// Culling and recording only read entity components, chunk by chunk
+	// Every entity is a primitive of the culling BVH, built from its starting world bounds
+	// The spheres stand still in rows going away from the camera, so each row uses a coarser level of detail
+	// The large sphere comes last, behind the cubes
+	// GPU-Driven Culling
+	// Every mesh an entity can refer to is registered, entities are then culled and drawn without CPU visibility work
+	// Instances are uploaded once here, afterwards only the ones whose scene node moved are rewritten
+	unique_ptr<GPUCuller> gpuCuller;
+	if (gpuDriven)
+	{
+		gpuCuller.reset(new GPUCuller());
+		gpuCuller->AddMesh(cube);
+		gpuCuller->AddMesh(sphere);
+		gpuCuller->AddMesh(largeSphere);
+	}
+	vector<GPUInstance> gpuInstances;
+	vector<int> nodeGpuInstances(scene.GetNodeCount(), -1); // Instance of each scene node's entity, -1 for none
+
+	scene.Update();
+	EntityWorld entities;
+	BVH cullingBVH;
+	const int entityCount = cubeCount + sphereCount + 1;
+	vector<AABB> entityWorldBounds(entityCount);
+	for (int i = 0; i < entityCount; i++)
+	{
+		bool isCube = i < cubeCount;
+		bool isLargeSphere = i == entityCount - 1;
+		Object& object = isCube ? cube : (isLargeSphere ? largeSphere : sphere);
+		int sphereIndex = i - cubeCount;
+		mat4 worldMatrix = isCube ? scene.GetWorldMatrix(cubeNodes[i]) :
+						   isLargeSphere ? translate(mat4(1.0f), vec3(0.0f, 2.0f, -30.0f)) :
+						   translate(mat4(1.0f), vec3((sphereIndex % sphereColumns - (sphereColumns - 1) * 0.5f) * 2.5f, -2.5f, -2.0f - (sphereIndex / sphereColumns) * 10.0f));
+
+		TransformComponent transform = { worldMatrix, isCube ? cubeNodes[i] : -1 };
+		MeshRefComponent mesh = { &object, gpuDriven ? gpuCuller->FindMesh(&object) : -1 };
+		BoundsComponent bounds = { object.GetBoundingSphere(), i }; // Local space, used for frustum culling
+		MaterialComponent material = { shader.ID, object.GetTexture() };
+		LodComponent lod = { 0, 0, 1.0f };
+		entities.CreateEntity(transform, mesh, bounds, material, lod);
+
+		if (mesh.gpuMesh != -1)
+		{
+			if (transform.sceneNode != -1)
+			{
+				nodeGpuInstances[transform.sceneNode] = (int)gpuInstances.size();
+			}
+			GPUInstance instance = { transform.worldMatrix, (unsigned int)mesh.gpuMesh, { 0, 0, 0 } };
+			gpuInstances.push_back(instance);
+		}
 
-	unsigned int VBO; // Vertex Buffer Object
-					  // Stores vertex data on the GPU memory
+		entityWorldBounds[i] = AABB::FromSphere(vec3(transform.worldMatrix * vec4(bounds.sphere.center, 1.0f)), bounds.sphere.radius);
+	}
+	cullingBVH.Build(entityWorldBounds);
+	if (gpuDriven)
+	{
+		gpuCuller->SetInstances(gpuInstances.data(), (int)gpuInstances.size());
+	}
+	vector<int> visibleProxies;
+	vector<unsigned char> proxyVisible(cullingBVH.GetPrimitiveCount());
 
-	glGenBuffers(1, &VBO);				// Generates a buffer ID to this object
-	glBindBuffer(GL_ARRAY_BUFFER, VBO); // Binds this object to the buffer type GL_ARRAY_BUFFER
-										// Only one buffer of the same buffer type can be bind at once
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW); // Copies object data into the currently bound buffer
-																			   // GL_STATIC_DRAW = Data will most likely not change
-																			   // GL_DYNAMIC_DRAW = Data will likely change a lot
-																			   // GL_STREAM_DRAW = Data will change every time it is drawn
+	// Software Occlusion Culling
+	// The nearest visible entities are rasterized on the CPU, the others are tested against them before submission
+	OcclusionCuller occlusionCuller;
+	vector<OccluderCandidate> occluderCandidates;
 
-	unsigned int EBO; // Element Buffer Object
-					  // Stores vertex indices
+	// Hardware Occlusion Culling
+	// Used instead when hardwareOcclusion is set, one query slot per BVH proxy
+	// Boxes are tested against this frame's depth, the draws of the next frame are conditional on the results
+	HardwareOcclusion occlusionQueries(cullingBVH.GetPrimitiveCount());
 
-	glGenBuffers(1, &EBO);						// Generates a buffer ID to this object
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);	// Binds this objects to the buffer type GL_ELEMENT_ARRAY_BUFFER
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+	// Per-instance model matrices -> layout (location = 2) to (location = 5)
+	InstanceBuffer instanceBuffer;
+	cube.SetInstanceBuffer(instanceBuffer);
 
-	// Tells OpenGL how to interpret the vertex data
-	glVertexAttribPointer(0,							// Specifies the location of the vertex attribute -> layout (location = 0)
-						  3,							// Size of the vertex attribute -> vec3
-						  GL_FLOAT,						// Type of data -> float
-						  GL_FALSE,						// Normlize data?
-						  5 * sizeof(float),			// Stride (Space between consecutive vertex attributes)
-						  (void*)0);					// Offset
+	// Batches every instanced draw of the frame into multi-draw indirect calls
+	DrawBatcher batcher(instanceBuffer);
 
-	glEnableVertexAttribArray(0); // Enables vertex attribute at specified location
+	// Command Recording
+	// Every entity chunk is recorded by one job into its own command buffer, the GL thread replays them in chunk order
+	// Draws are sorted within a chunk (by state, then front to back), not across chunks
+	GLCommandBackend commandBackend(batcher, &occlusionQueries);
 
-	// Tells OpenGL how to interpret the vertex color data
-	//glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-	//glEnableVertexAttribArray(1);
+	vector<ScenePartition> partitions;
+	double cullingReportTime = 0.0;
 
-	// Tells OpenGL how to interpret the vertex texture data
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
+	// Frame Pipeline
+	// Snapshots go from the simulation thread to the render thread through a triple buffer
+	TripleBuffer<FrameSnapshot> snapshots;
+	FramePacer pacer(frameLatency);
 
-	// Texture Sampling 1
-	unsigned int texture;
-	glGenTextures(1, &texture); // Generates texture data
+	//glPolygonMode(GL_FRONT_AND_BACK, GL_LINE); // Draws objects in wireframe
 
-	glBindTexture(GL_TEXTURE_2D, texture); // Binds texture
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	shader.use();
+	shader.setInt("texture2", 1);
 
-	stbi_set_flip_vertically_on_load(true);
+	// Uniform Handles
+	// Resolved once here so the render loop does no uniform lookups
+	UniformHandle<bool> instancedUniform = shader.getUniform<bool>("instanced");
+	UniformHandle<mat4> modelViewProjectionUniform = shader.getUniform<mat4>("modelViewProjectionMatrix");
+	UniformHandle<float> lodFadeUniform = shader.getUniform<float>("drawLodFade");
 
-	int textureWidth, textureHeight, colorChannels;
-	unsigned char *data = stbi_load("volt.jpg", &textureWidth, &textureHeight, &colorChannels, 0); // Reads texture from file
-	if (data)
-	{
-		// Generates texture from image
-		glTexImage2D(GL_TEXTURE_2D,		// Texture target
-			0,					// Mipmap level
-			GL_RGB,			// Format to store the texture
-			textureWidth,		// Width
-			textureHeight,		// Height
-			0,					// Should always be 0
-			GL_RGB,			// Format of the image
-			GL_UNSIGNED_BYTE,	// Data type of the image
-			data);				// Image data
-
-		glGenerateMipmap(GL_TEXTURE_2D); // Generate mipmaps for the texture
-	}
-	else
+	// Scene Pipeline
+	// Every mesh is wound counter clockwise seen from outside, so back faces are culled and meshlets facing away can be skipped
+	const PipelineState scenePipeline(true, true, false, true);
+
+	// Camera Uniform Block
+	// View and projection are uploaded once per frame and shared by every shader program
+	CameraUniformBuffer cameraBuffer;
+
+	// Simulation Thread
+	// Animates, culls, sorts and records frame N + 1 while the main thread renders frame N
+	// Owns the camera from here on, the render thread only sees the CameraBlock of each snapshot
+	thread simulationThread([&]()
 	{
-		cout << "Failed to load texture" << endl;
-	}
-	stbi_image_free(data); // Deletes image data
-
-											// Texture Wrapping
-											// glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-											//								  GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT
-											//								  GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE
-											// glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
-
-											// Texture Filtering
-											// glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-											// glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-											// Mipmaping
-											// GL_NEAREST_MIPMAP_NEAREST - Nearest mipmap with nearest sampling
-											// GL_LINEAR_MIPMAP_NEAREST - Nearest mipmap with linear sampling
-											// GL_NEAREST_MIPMAP_LINEAR - Linear mipmap with nearest sampling
-											// GL_LINEAR_MIPMAP_LINEAR - Linear mipmap with linear sampling
-											// Mipmaping filtering should not be used on magnification filter !!!
-
-	// Unbinding
-	glBindVertexArray(0);						// Unbinds VAO
-	glBindBuffer(GL_ARRAY_BUFFER, 0);			// Unbinds VBO
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);	// Unbinds EBO
+		JobSystem::AttachThread();
+		float previousTime = (float)glfwGetTime();
 
-	//glPolygonMode(GL_FRONT_AND_BACK, GL_LINE); // Draws objects in wireframe
+		for (long long frame = 0; pacer.WaitToSimulate(frame); frame++)
+		{
+			FrameSnapshot& snapshot = snapshots.GetWriteSlot();
+			snapshot.frame = frame;
+
+			// Draw Stuff
+			//float timeValue = glfwGetTime();
+			//float greenValue = (sin(timeValue) / 2.0f) + 0.5f;
+			//int vertexColorLocation = glGetUniformLocation(shaderProgram, "ourColor"); // Gets uniform variable location
+
+			// Camera state is read by every recording job, so it is resolved here first
+			float time = (float)glfwGetTime();
+			float deltaTime = time - previousTime;
+			previousTime = time;
+			snapshot.camera = CameraBlock::FromCamera(camera);
+			const mat4& viewMatrix = snapshot.camera.viewMatrix;
+			const mat4& viewProjection = snapshot.camera.viewProjectionMatrix;
+			Frustum frustum = Frustum::FromMatrix(viewProjection);
+			vec3 cameraPosition = vec3(snapshot.camera.position);
+			float farPlaneDistance = camera.GetFarPlaneDistance();
+
+			snapshot.frameCommands.Reset();
+			snapshot.frameCommands.BindPipeline(shader, scenePipeline);
+			snapshot.frameCommands.SetUniform(instancedUniform, instancedRendering || gpuDriven);
+
+			// Animation only touches rotations, the local matrices are then built four at a time
+			JobSystem::ParallelFor(cubeCount, TransformStore::PARALLEL_GRAIN_SIZE, [&](int begin, int end)
+			{
+				for (int cubeIndex = begin; cubeIndex < end; cubeIndex++)
+				{
+					float angle = (20.0f * cubeIndex) + (time * 10);
+					cubeTransforms.SetRotation(cubeIndex, angleAxis(glm::radians(angle), cubeRotationAxis));
+				}
+			});
+			cubeTransforms.ComputeMatrices(cubeLocalMatrices.data());
+
+			// The hierarchy update is a single pass, between animating and recording
+			for (int i = 0; i < cubeCount; i++)
+			{
+				scene.SetLocalMatrix(cubeNodes[i], cubeLocalMatrices[i]);
+			}
+			scene.Update();
+
+			// GPU-driven frames hand over the transforms that changed, the GPU culls every instance and builds the draws itself
+			// Only the scene nodes the hierarchy update recomputed are looked at, nothing here is per entity
+			if (gpuDriven)
+			{
+				snapshot.gpuInstanceUpdates.clear();
+				for (int node : scene.GetUpdatedNodes())
+				{
+					if (nodeGpuInstances[node] != -1)
+					{
+						GPUInstanceUpdate update = { nodeGpuInstances[node], scene.GetWorldMatrix(node) };
+						snapshot.gpuInstanceUpdates.push_back(update);
+					}
+				}
+				snapshot.partitionCommands.clear();
+				snapshot.occlusionCommands.clear();
+				snapshot.visibleCount = 0;
+				snapshot.culledCount = 0;
+				snapshot.occludedCount = 0;
+				snapshot.triangleCount = 0;
+				snapshot.meshletCount = 0;
+				snapshot.visibleMeshletCount = 0;
+			}
+			else
+			{
+				// World matrices come from the hierarchy, only entities whose bounds changed refit the BVH
+				entities.ForEachChunk<TransformComponent, BoundsComponent>([&](int count, TransformComponent* transforms, BoundsComponent* bounds)
+				{
+					for (int i = 0; i < count; i++)
+					{
+						if (transforms[i].sceneNode != -1)
+						{
+							transforms[i].worldMatrix = scene.GetWorldMatrix(transforms[i].sceneNode);
+						}
+						if (bounds[i].proxy == -1)
+						{
+							continue;
+						}
+
+						AABB worldBounds = AABB::FromSphere(vec3(transforms[i].worldMatrix * vec4(bounds[i].sphere.center, 1.0f)), bounds[i].sphere.radius);
+						const AABB& previousBounds = cullingBVH.GetBounds(bounds[i].proxy);
+						if (worldBounds.min != previousBounds.min || worldBounds.max != previousBounds.max)
+						{
+							cullingBVH.SetBounds(bounds[i].proxy, worldBounds);
+						}
+					}
+				});
+				cullingBVH.Refit();
+
+				// Hierarchical frustum culling, the chunks then only look up their entities' results
+				cullingBVH.QueryFrustum(frustum, visibleProxies);
+				fill(proxyVisible.begin(), proxyVisible.end(), (unsigned char)0);
+				for (int proxy : visibleProxies)
+				{
+					proxyVisible[proxy] = 1;
+				}
+
+				// The GPU tests occlusion itself in hardware mode
+				if (!hardwareOcclusion)
+				{
+					occluderCandidates.clear();
+					entities.ForEachChunk<TransformComponent, BoundsComponent, MeshRefComponent>([&](int count, TransformComponent* transforms, BoundsComponent* bounds, MeshRefComponent* meshes)
+					{
+						for (int i = 0; i < count; i++)
+						{
+							if (bounds[i].proxy != -1 && proxyVisible[bounds[i].proxy])
+							{
+								OccluderCandidate candidate = { -(viewMatrix * transforms[i].worldMatrix[3]).z, meshes[i].object, &transforms[i].worldMatrix };
+								occluderCandidates.push_back(candidate);
+							}
+						}
+					});
+					int occluderCount = std::min((int)occluderCandidates.size(), maxOccluders);
+					partial_sort(occluderCandidates.begin(), occluderCandidates.begin() + occluderCount, occluderCandidates.end(),
+								 [](const OccluderCandidate& a, const OccluderCandidate& b) { return a.depth < b.depth; });
+
+					occlusionCuller.Begin(viewProjection);
+					for (int i = 0; i < occluderCount; i++)
+					{
+						Object& object = *occluderCandidates[i].object;
+						occlusionCuller.AddOccluder(object.GetVertices().data(), (int)object.GetVertices().size() / object.GetVertexStride(), object.GetVertexStride(),
+													object.GetIndices().data(), (int)object.GetIndices().size(), *occluderCandidates[i].worldMatrix);
+					}
+					occlusionCuller.Rasterize();
+				}
+
+				int partitionCount = entities.CountChunks<TransformComponent, BoundsComponent, MeshRefComponent, MaterialComponent, LodComponent>();
+				partitions.resize(partitionCount);
+				snapshot.partitionCommands.resize(partitionCount);
+				snapshot.occlusionCommands.resize(partitionCount);
+
+				entities.ParallelForEachChunk<TransformComponent, BoundsComponent, MeshRefComponent, MaterialComponent, LodComponent>(
+					[&](int chunkIndex, int count, TransformComponent* transforms, BoundsComponent* bounds, MeshRefComponent* meshes, MaterialComponent* materials, LodComponent* lods)
+				{
+					ScenePartition& partition = partitions[chunkIndex];
+					CommandBuffer& commands = snapshot.partitionCommands[chunkIndex];
+					CommandBuffer& occlusionCommands = snapshot.occlusionCommands[chunkIndex];
+
+					// Rejects entities outside of the camera view or hidden by occluders before anything is submitted
+					// With hardware occlusion every entity in view is drawn conditionally and gets its box queried
+					partition.visibleEntities.clear();
+					partition.occludedCount = 0;
+					occlusionCommands.Reset();
+					for (int i = 0; i < count; i++)
+					{
+						vec3 center = vec3(transforms[i].worldMatrix * vec4(bounds[i].sphere.center, 1.0f));
+
+						// Levels follow every entity, visible or not, so one coming back into view has finished its fade
+						float size = LodSelector::ProjectedSize(vec3(viewMatrix * vec4(center, 1.0f)), bounds[i].sphere.radius, snapshot.camera.projectionMatrix);
+						LodSelector::Update(lods[i], size, meshes[i].object->GetLodCount(), deltaTime, lodCrossFade);
+
+						bool visible = bounds[i].proxy != -1 ? proxyVisible[bounds[i].proxy] != 0 : frustum.IsVisible(center, bounds[i].sphere.radius);
+						if (visible && hardwareOcclusion && bounds[i].proxy != -1)
+						{
+							AABB box = AABB::FromSphere(center, bounds[i].sphere.radius);
+							occlusionCommands.QueryOcclusion(bounds[i].proxy, box.min, box.max);
+						}
+						else if (visible && !hardwareOcclusion && occlusionCuller.IsOccluded(AABB::FromSphere(center, bounds[i].sphere.radius)))
+						{
+							partition.occludedCount++;
+							visible = false;
+						}
+						if (visible)
+						{
+							partition.visibleEntities.push_back(i);
+						}
+					}
+
+					// The decode matrix rescales quantized mesh positions
+					// Sort keys use the entity origin's view depth
+					partition.visibleMatrices.resize(partition.visibleEntities.size());
+					partition.renderQueue.Clear();
+					for (size_t i = 0; i < partition.visibleEntities.size(); i++)
+					{
+						int entity = partition.visibleEntities[i];
+						Object& object = *meshes[entity].object;
+						const mat4& model = transforms[entity].worldMatrix;
+						partition.visibleMatrices[i] = model * object.GetPositionDecodeMatrix();
+
+						float depth = Camera::GetNormalizedDepth(viewMatrix, farPlaneDistance, vec3(model[3]));
+						partition.renderQueue.Submit(RenderQueue::MakeOpaqueKey(materials[entity].shader, object.GetArena().GetID(), materials[entity].texture, object.GetID(), depth), (uint32_t)i);
+					}
+					partition.renderQueue.Sort();
+					const vector<RenderItem>& renderItems = partition.renderQueue.GetItems();
+
+					// A fading entity is drawn at both levels with complementary dither patterns
+					commands.Reset();
+					partition.triangleCount = 0;
+					partition.meshletCount = 0;
+					partition.visibleMeshletCount = 0;
+					for (size_t i = 0; i < renderItems.size(); i++)
+					{
+						int entity = partition.visibleEntities[renderItems[i].index];
+						Object& object = *meshes[entity].object;
+						const LodComponent& lod = lods[entity];
+						bool fading = lod.fade < 1.0f;
+						for (int level = 0; level < (fading ? 2 : 1); level++)
+						{
+							int drawnLod = level == 0 ? lod.lod : lod.previousLod;
+							float fade = !fading ? 0.0f : (level == 0 ? lod.fade : lod.fade - 1.0f);
+
+							// Level 0 of a large mesh only draws its meshlets inside the frustum and facing the camera
+							const MeshletCuller& meshlets = object.GetMeshletCuller();
+							bool clustered = drawnLod == 0 && meshlets.GetMeshletCount() > 0;
+							if (clustered)
+							{
+								partition.meshletCount += meshlets.GetMeshletCount();
+								partition.visibleMeshletCount += meshlets.Cull(transforms[entity].worldMatrix, frustum, cameraPosition, scenePipeline.cullFace, partition.visibleRanges);
+								for (const IndexRange& range : partition.visibleRanges)
+								{
+									partition.triangleCount += range.indexCount / 3;
+								}
+							}
+							else
+							{
+								partition.triangleCount += object.GetAllocation(drawnLod).indexCount / 3;
+							}
+
+							mat4 model = partition.visibleMatrices[renderItems[i].index];
+							const IndexRange* ranges = partition.visibleRanges.data();
+							int rangeCount = (int)partition.visibleRanges.size();
+							if (instancedRendering)
+							{
+								model[0][3] = fade; // Read back and cleared by the vertex shader
+								if (clustered)
+								{
+									commands.DrawInstanceRanges(object, model, ranges, rangeCount);
+								}
+								else
+								{
+									commands.DrawInstances(object, &model, 1, drawnLod); // Consecutive instances of the same mesh merge into one indirect command
+								}
+							}
+							else
+							{
+								commands.SetUniform(modelViewProjectionUniform, viewProjection * model); // MVP combined once per object instead of per vertex
+								commands.SetUniform(lodFadeUniform, fade);
+								if (clustered)
+								{
+									commands.DrawRanges(object, ranges, rangeCount, hardwareOcclusion ? bounds[entity].proxy : -1);
+								}
+								else
+								{
+									commands.Draw(object, hardwareOcclusion ? bounds[entity].proxy : -1, drawnLod);
+								}
+							}
+						}
+					}
+				});
+
+				snapshot.visibleCount = 0;
+				snapshot.occludedCount = 0;
+				snapshot.triangleCount = 0;
+				snapshot.meshletCount = 0;
+				snapshot.visibleMeshletCount = 0;
+				for (int p = 0; p < partitionCount; p++)
+				{
+					snapshot.visibleCount += (int)partitions[p].visibleEntities.size();
+					snapshot.occludedCount += partitions[p].occludedCount;
+					snapshot.triangleCount += partitions[p].triangleCount;
+					snapshot.meshletCount += partitions[p].meshletCount;
+					snapshot.visibleMeshletCount += partitions[p].visibleMeshletCount;
+				}
+				snapshot.culledCount = entities.GetEntityCount() - snapshot.visibleCount - snapshot.occludedCount;
+			}
+
+			if (!pacer.WaitToPublish(frame))
+			{
+				break;
+			}
+			snapshots.Publish();
+		}
 
-	shader.use();
-	shader.setInt("texture2", 1);
+		JobSystem::DetachThread();
+	});
 
 	// Render Loop
+	// Input, window events and every GL call stay on the main thread
 	while (!glfwWindowShouldClose(window))
 	{
 		// Input process
 		processInput(window);
 
+		// Keeps the window responsive while the simulation thread finishes the next frame
+		if (!snapshots.Acquire())
+		{
+			glfwPollEvents();
+			this_thread::yield();
+			continue;
+		}
+		FrameSnapshot& snapshot = snapshots.GetReadSlot();
+		pacer.FrameAcquired(snapshot.frame); // Lets the simulation start on the next frame
+		occlusionQueries.BeginFrame(); // Picks up whichever query results are ready, never waits
+
+		GLState::ResetCounters(); // State call counters cover one frame
+
 		// Background Color
 		glClearColor(0.2f, 0.3f, 0.3f, 1.0f); // Set background color
 		glClear(GL_COLOR_BUFFER_BIT);		  // Clear color buffer with selected background color
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); // Clear depth buffer
 
-		// Draw Stuff
-		//float timeValue = glfwGetTime();
-		//float greenValue = (sin(timeValue) / 2.0f) + 0.5f;
-		//int vertexColorLocation = glGetUniformLocation(shaderProgram, "ourColor"); // Gets uniform variable location
+		cameraBuffer.Update(snapshot.camera);
 
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, texture);
+		// Culled before the pipeline is bound, the pass switches to its compute program
+		if (gpuDriven)
+		{
+			gpuCuller->UpdateInstances(snapshot.gpuInstanceUpdates.data(), (int)snapshot.gpuInstanceUpdates.size());
+			gpuCuller->Cull(snapshot.camera.viewProjectionMatrix);
+		}
 
-		glBindVertexArray(VAO);				// Binds VAO
+		// GL calls only happen here, on the context thread
+		commandBackend.Begin();
+		commandBackend.Execute(snapshot.frameCommands);
+		for (size_t p = 0; p < snapshot.partitionCommands.size(); p++)
+		{
+			commandBackend.Execute(snapshot.partitionCommands[p]);
+		}
+		for (size_t p = 0; p < snapshot.occlusionCommands.size(); p++)
+		{
+			commandBackend.Execute(snapshot.occlusionCommands[p]); // After every draw, so the boxes test against the whole frame
+		}
+		commandBackend.End(); // Draws every visible cube in one call when instanced
 
-		for (int i = 0; i < 10; i++)
+		// Survivors of the GPU pass, then the frame's depth becomes the next frame's occlusion pyramid
+		if (gpuDriven)
 		{
-			glm::mat4 model = glm::mat4(1.0f);
-			model = glm::translate(model, cubePositions[i]);
-			float angle = (20.0f * i) + (glfwGetTime() * 10);
-			model = glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
+			gpuCuller->Draw();
 
-			shader.setMat4("modelMatrix", model);
-			glDrawArrays(GL_TRIANGLES, 0, 36);
+			int framebufferWidth, framebufferHeight;
+			glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+			gpuCuller->BuildHiZ(framebufferWidth, framebufferHeight);
 		}
 
-		shader.setMat4("viewMatrix", camera.GetViewMatrix());
-		shader.setMat4("projectionMatrix", camera.GetProjectionMatrix());
+		// Culling and state cache counters, shown in the window title once per second
+		if (glfwGetTime() - cullingReportTime > 1.0)
+		{
+			cullingReportTime = glfwGetTime();
+
+			// GPU-driven visibility never comes back to the CPU
+			string title = gpuDriven ? "LearnOpenGL - GPU culled instances: " + to_string(gpuCuller->GetInstanceCount()) :
+						   "LearnOpenGL - Visible: " + to_string(snapshot.visibleCount) + " Culled: " + to_string(snapshot.culledCount) +
+						   " Occluded: " + to_string(hardwareOcclusion ? occlusionQueries.GetOccludedCount() : snapshot.occludedCount) +
+						   " Triangles: " + to_string(snapshot.triangleCount) +
+						   " Meshlets: " + to_string(snapshot.visibleMeshletCount) + "/" + to_string(snapshot.meshletCount);
+			title += " State calls: " + to_string(GLState::GetIssuedCalls()) + " issued, " + to_string(GLState::GetSkippedCalls()) + " skipped";
+			glfwSetWindowTitle(window, title.c_str());
+		}
 
 		//glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);	// Drawing function (with EBO)
 																// First Argument = Type of OpenGL drawing primitive
@@ -298,6 +775,10 @@ int main()
 		glfwSwapBuffers(window); // Output color buffer to the screen
 	}
 
+	pacer.Stop();
+	simulationThread.join();
+
+	JobSystem::Shutdown();
 	glfwTerminate();
 	return 0;
 }
\ No newline at end of file
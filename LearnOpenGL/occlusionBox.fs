@@ -0,0 +1,9 @@
+#version 330 core
+
+// Only depth is tested, color writes are masked while the boxes draw
+out vec4 fragmentColor;
+
+void main()
+{
+	fragmentColor = vec4(1.0);
+}
\ No newline at end of file
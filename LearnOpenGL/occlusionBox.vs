@@ -0,0 +1,21 @@
+#version 330 core
+
+layout (location = 0) in vec3 position; // Unit cube corner, 0 or 1 on each axis
+
+// Shared by every program, bound to CAMERA_BLOCK_BINDING
+layout (std140) uniform Camera
+{
+	mat4 viewMatrix;
+	mat4 projectionMatrix;
+	mat4 viewProjectionMatrix;
+	vec4 cameraPosition;
+};
+
+uniform vec3 boundsMin;
+uniform vec3 boundsSize;
+
+void main()
+{
+	// The unit cube is stretched over the world space bounds, no model matrix needed
+	gl_Position = viewProjectionMatrix * vec4(boundsMin + position * boundsSize, 1.0);
+}
\ No newline at end of file
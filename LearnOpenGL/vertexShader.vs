@@ -1,16 +1,41 @@
 #version 330 core
 
-layout (location = 0) in vec3 position;
+layout (location = 0) in vec3 position; // Quantized meshes fetch snorm positions in [-1, 1], the model matrix holds their decode scale and offset
 layout (location = 1) in vec2 textureCoordinates;
+layout (location = 2) in mat4 instanceMatrix; // Per-instance model matrix (locations 2 to 5)
+											  // Batched draws start at their baseInstance, so this is also the per-draw data
 
 out vec2 uv;
+flat out float lodFade; // Dithered level of detail cross-fade, 0 when the draw is not fading
 
-uniform mat4 modelMatrix;
-uniform mat4 viewMatrix;
-uniform mat4 projectionMatrix;
+// Shared by every program, bound to CAMERA_BLOCK_BINDING
+layout (std140) uniform Camera
+{
+	mat4 viewMatrix;
+	mat4 projectionMatrix;
+	mat4 viewProjectionMatrix;
+	vec4 cameraPosition;
+};
+
+uniform bool instanced;
+uniform mat4 modelViewProjectionMatrix; // Combined on the CPU for non-instanced draws
+uniform float drawLodFade; // lodFade of non-instanced draws, instanced ones carry it in their matrix
 
 void main()
 {
-	gl_Position = projectionMatrix * viewMatrix * modelMatrix * vec4(position, 1.0);
+	// Only matrix * vector products per vertex, the matrix * matrix products are done once on the CPU
+	if (instanced)
+	{
+		// The fade rides in the model matrix's bottom row, always 0 for affine transforms
+		mat4 modelMatrix = instanceMatrix;
+		lodFade = modelMatrix[0][3];
+		modelMatrix[0][3] = 0.0;
+		gl_Position = viewProjectionMatrix * (modelMatrix * vec4(position, 1.0));
+	}
+	else
+	{
+		lodFade = drawLodFade;
+		gl_Position = modelViewProjectionMatrix * vec4(position, 1.0);
+	}
 	uv = textureCoordinates;
 }
\ No newline at end of file